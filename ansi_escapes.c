@@ -1,15 +1,11 @@
 #include "ansi_escapes.h"
 #include <stdio.h>
 
-#include "color.h"
 #include <ctype.h>
 #include "terminal.h"
-#include "window.h"
 #include <limits.h>
 #include <string.h>
 
-#include "pterminal.h"
-
 CSIEscape csiescseq;
 STREscape strescseq;
 
@@ -17,6 +13,10 @@ void csihandle(void) {
   char buf[40];
   int len;
 
+  /* only DEC private (?) sequences are understood */
+  if (csiescseq.priv && csiescseq.priv != '?')
+    goto unknown;
+
   switch (csiescseq.mode[0]) {
   default:
   unknown:
@@ -58,7 +58,7 @@ void csihandle(void) {
     break;
   case 'c': /* DA -- Device Attributes */
     if (csiescseq.arg[0] == 0)
-      write_to_tty(vtiden, strlen(vtiden), 0);
+      terminal_callbacks.ttywrite(vtiden, strlen(vtiden), 0);
     break;
   case 'b': /* REP -- if last char is printable print it <n> more times */
     LIMIT(csiescseq.arg[0], 1, 65535);
@@ -190,12 +190,12 @@ void csihandle(void) {
   case 'n': /* DSR -- Device Status Report */
     switch (csiescseq.arg[0]) {
     case 5: /* Status Report "OK" `0n` */
-      write_to_tty("\033[0n", sizeof("\033[0n") - 1, 0);
+      terminal_callbacks.ttywrite("\033[0n", sizeof("\033[0n") - 1, 0);
       break;
     case 6: /* Report Cursor Position (CPR) "<row>;<column>R" */
       len = snprintf(buf, sizeof(buf), "\033[%i;%iR", term.cursor.y + 1,
                      term.cursor.x + 1);
-      write_to_tty(buf, len, 0);
+      terminal_callbacks.ttywrite(buf, len, 0);
       break;
     default:
       goto unknown;
@@ -220,13 +220,25 @@ void csihandle(void) {
   case ' ':
     switch (csiescseq.mode[1]) {
     case 'q': /* DECSCUSR -- Set Cursor Style */
-      if (set_terminal_cursor(csiescseq.arg[0]))
+      if (terminal_callbacks.setcursor(csiescseq.arg[0]))
         goto unknown;
       break;
     default:
       goto unknown;
     }
     break;
+  case '$':
+    switch (csiescseq.mode[1]) {
+    case 'p': /* DECRQM -- Request Mode */
+      len = snprintf(buf, sizeof(buf), "\033[%s%d;%d$y",
+                     csiescseq.priv ? "?" : "", csiescseq.arg[0],
+                     tgetmode(csiescseq.priv, csiescseq.arg[0]));
+      terminal_callbacks.ttywrite(buf, len, 0);
+      break;
+    default:
+      goto unknown;
+    }
+    break;
   }
 }
 
@@ -241,7 +253,6 @@ void strhandle(void) {
                    {defaultbg, "background"},
                    {defaultcs, "cursor"}};
 
-  term.esc &= ~(ESC_STR_END | ESC_STR);
   strparse();
   par = (narg = strescseq.narg) ? atoi(strescseq.args[0]) : 0;
 
@@ -250,24 +261,23 @@ void strhandle(void) {
     switch (par) {
     case 0:
       if (narg > 1) {
-        //xsettitle(strescseq.args[1]);
-        //xseticontitle(strescseq.args[1]);
+        terminal_callbacks.settitle(strescseq.args[1]);
+        terminal_callbacks.seticontitle(strescseq.args[1]);
       }
       return;
     case 1:
       if (narg > 1)
-        //xseticontitle(strescseq.args[1]);
+        terminal_callbacks.seticontitle(strescseq.args[1]);
       return;
     case 2:
       if (narg > 1)
-        //xsettitle(strescseq.args[1]);
+        terminal_callbacks.settitle(strescseq.args[1]);
       return;
     case 52:
       if (narg > 2 && allowwindowops) {
         dec = base64dec(strescseq.args[2]);
         if (dec) {
-          //xsetsel(dec);
-          //xclipcopy();
+          terminal_callbacks.setsel(dec);
         } else {
           fprintf(stderr, "erresc: invalid base64\n");
         }
@@ -284,7 +294,7 @@ void strhandle(void) {
 
       if (!strcmp(p, "?")) {
         osc_color_response(par, osc_table[j].idx, 0);
-      } else if (xsetcolorname(osc_table[j].idx, p)) {
+      } else if (terminal_callbacks.setcolorname(osc_table[j].idx, p)) {
         fprintf(stderr, "erresc: invalid %s color: %s\n", osc_table[j].str, p);
       } else {
         tfulldirt();
@@ -300,9 +310,9 @@ void strhandle(void) {
 
       if (p && !strcmp(p, "?")) {
         osc_color_response(j, 0, 1);
-      } else if (xsetcolorname(j, p)) {
+      } else if (terminal_callbacks.setcolorname(j, p)) {
         if (par == 104 && narg <= 1) {
-          xloadcols();
+          terminal_callbacks.loadcols();
           return; /* color reset without parameter */
         }
         fprintf(stderr, "erresc: invalid color j=%d, p=%s\n", j,
@@ -318,7 +328,7 @@ void strhandle(void) {
     }
     break;
   case 'k': /* old title set compatibility */
-    //xsettitle(strescseq.args[0]);
+    terminal_callbacks.settitle(strescseq.args[0]);
     return;
   case 'P': /* DCS -- Device Control String */
   case '_': /* APC -- Application Program Command */
@@ -375,41 +385,101 @@ void strdump(void) {
   fprintf(stderr, "ESC\\\n");
 }
 
+void strput(Rune u) {
+  char c[UTF_SIZ];
+  int len;
+
+  if (u < 127 || !IS_SET(MODE_UTF8)) {
+    c[0] = u;
+    len = 1;
+  } else {
+    len = utf8encode(u, c);
+  }
+
+  if (strescseq.len + len >= strescseq.siz) {
+    /*
+     * Here is a bug in terminals. If the user never sends
+     * some code to stop the str or esc command, then st
+     * will stop responding. But this is better than
+     * silently failing with unknown characters. At least
+     * then users will report back.
+     *
+     * In the case users ever get fixed, here is the code:
+     */
+    /*
+     * term.esc = 0;
+     * strhandle();
+     */
+    if (strescseq.siz > (SIZE_MAX - UTF_SIZ) / 2)
+      return;
+    strescseq.siz *= 2;
+    strescseq.buf = xrealloc(strescseq.buf, strescseq.siz);
+  }
+
+  memmove(&strescseq.buf[strescseq.len], c, len);
+  strescseq.len += len;
+}
+
 void strreset(void) {
   strescseq = (STREscape){
       .buf = xrealloc(strescseq.buf, STR_BUF_SIZ),
       .siz = STR_BUF_SIZ,
   };
 }
-void csiparse(void) {
-  char *p = csiescseq.buf, *np;
-  long int v;
-  int sep = ';'; /* colon or semi-colon, but not both */
+/*
+ * The CSI actions below are run by the parser in tputc() as the bytes of
+ * a sequence arrive, so the parameters are complete when the final byte
+ * is seen and the raw string never has to be scanned again.
+ */
+static void csiraw(uchar c) {
+  if (csiescseq.len < sizeof(csiescseq.buf) - 1)
+    csiescseq.buf[csiescseq.len++] = c;
+}
 
-  csiescseq.narg = 0;
-  if (*p == '?') {
-    csiescseq.priv = 1;
-    p++;
+void csiparam(uchar c) {
+  int *arg;
+
+  csiraw(c);
+  if (BETWEEN(c, '<', '?')) {
+    csiescseq.priv = c;
+    return;
   }
 
+  /* colon or semi-colon both separate arguments, extra ones are dropped */
+  if (csiescseq.narg == 0)
+    csiescseq.narg = 1;
+  if (c == ';' || c == ':') {
+    if (csiescseq.narg <= ESC_ARG_SIZ)
+      csiescseq.narg++;
+    return;
+  }
+  if (csiescseq.narg > ESC_ARG_SIZ)
+    return;
+
+  /* overflowing arguments become -1 and stay so */
+  arg = &csiescseq.arg[csiescseq.narg - 1];
+  if (*arg < 0 || *arg > (INT_MAX - 9) / 10)
+    *arg = -1;
+  else
+    *arg = *arg * 10 + (c - '0');
+}
+
+void csicollect(uchar c) {
+  csiraw(c);
+  if (!csiescseq.inter)
+    csiescseq.inter = c;
+}
+
+void csifinal(uchar c) {
+  csiraw(c);
   csiescseq.buf[csiescseq.len] = '\0';
-  while (p < csiescseq.buf + csiescseq.len) {
-    np = NULL;
-    v = strtol(p, &np, 10);
-    if (np == p)
-      v = 0;
-    if (v == LONG_MAX || v == LONG_MIN)
-      v = -1;
-    csiescseq.arg[csiescseq.narg++] = v;
-    p = np;
-    if (sep == ';' && *p == ':')
-      sep = ':'; /* allow override to colon once */
-    if (*p != sep || csiescseq.narg == ESC_ARG_SIZ)
-      break;
-    p++;
+  LIMIT(csiescseq.narg, 1, ESC_ARG_SIZ);
+  if (csiescseq.inter) {
+    csiescseq.mode[0] = csiescseq.inter;
+    csiescseq.mode[1] = c;
+  } else {
+    csiescseq.mode[0] = c;
   }
-  csiescseq.mode[0] = *p++;
-  csiescseq.mode[1] = (p < csiescseq.buf + csiescseq.len) ? *p : '\0';
 }
 
 void print_csi(const char* csi) {
@@ -456,14 +526,22 @@ void csidump(void) {
   putc('\n', stderr);
 }
 
-void csireset(void) { memset(&csiescseq, 0, sizeof(csiescseq)); }
+void csireset(void) {
+  /* the raw buffer is only read up to len, no need to clear it */
+  csiescseq.len = 0;
+  csiescseq.priv = 0;
+  csiescseq.inter = 0;
+  csiescseq.narg = 0;
+  memset(csiescseq.arg, 0, sizeof(csiescseq.arg));
+  csiescseq.mode[0] = csiescseq.mode[1] = 0;
+}
 
 void osc_color_response(int num, int index, int is_osc4) {
   int n;
   char buf[32];
   unsigned char r, g, b;
 
-  if (xgetcolor(is_osc4 ? num : index, &r, &g, &b)) {
+  if (terminal_callbacks.getcolor(is_osc4 ? num : index, &r, &g, &b)) {
     fprintf(stderr, "erresc: failed to fetch %s color %d\n",
             is_osc4 ? "osc4" : "osc", is_osc4 ? num : index);
     return;
@@ -476,6 +554,6 @@ void osc_color_response(int num, int index, int is_osc4) {
             n < 0 ? "snprintf failed" : "truncation occurred",
             is_osc4 ? "osc4" : "osc");
   } else {
-    write_to_tty(buf, n, 1);
+    terminal_callbacks.ttywrite(buf, n, 1);
   }
 }
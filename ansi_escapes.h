@@ -11,22 +11,26 @@
 #define STR_BUF_SIZ ESC_BUF_SIZ
 #define STR_ARG_SIZ ESC_ARG_SIZ
 
+/* parser states, see the transition table in terminal.c */
 enum escape_state {
-  ESC_START = 1,
-  ESC_CSI = 2,
-  ESC_STR = 4, /* DCS, OSC, PM, APC */
-  ESC_ALTCHARSET = 8,
-  ESC_STR_END = 16, /* a final string was encountered */
-  ESC_TEST = 32,    /* Enter in test mode */
-  ESC_UTF8 = 64,
+  ESC_GROUND,
+  ESC_ESCAPE,
+  ESC_ESCAPE_INTERMEDIATE,
+  ESC_CSI_ENTRY,
+  ESC_CSI_PARAM,
+  ESC_CSI_INTERMEDIATE,
+  ESC_CSI_IGNORE,
+  ESC_STR, /* DCS, OSC, PM, APC */
+  ESC_STATES,
 };
 
 /* CSI Escape sequence structs */
-/* ESC '[' [[ [<priv>] <arg> [;]] <mode> [<mode>]] */
+/* ESC '[' [[ [<priv>] <arg> [;]] [<intermediate>] <mode>] */
 typedef struct {
-  char buf[ESC_BUF_SIZ]; /* raw string */
+  char buf[ESC_BUF_SIZ]; /* raw string, only kept for csidump() */
   size_t len;            /* raw string length */
-  char priv;
+  char priv;             /* private marker, one of < = > ? */
+  char inter;            /* first intermediate byte, also used by ESC */
   int arg[ESC_ARG_SIZ];
   int narg; /* nb of args */
   char mode[2];
@@ -44,15 +48,18 @@ typedef struct {
 
 } STREscape;
 
+void csicollect(uchar);
 void csidump(void);
+void csifinal(uchar);
 void csihandle(void);
-void csiparse(void);
+void csiparam(uchar);
 void csireset(void);
 void osc_color_response(int, int, int);
-int eschandle(uchar);
+void eschandle(uchar);
 void strdump(void);
 void strhandle(void);
 void strparse(void);
+void strput(Rune);
 void strreset(void);
 
 void print_csi(const char* csi);
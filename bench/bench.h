@@ -0,0 +1,101 @@
+/* See LICENSE for license details. */
+/*
+ * What the benchmarks share: a clock, byte streams to generate or read
+ * test input into, and the memory the process uses. Sizes are in KB.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "terminal.h"
+
+typedef struct {
+  char *buf;
+  size_t len, cap;
+} Stream;
+
+static inline double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1E9;
+}
+
+static inline void sput(Stream *s, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static inline void sput(Stream *s, const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  for (;;) {
+    va_start(ap, fmt);
+    n = vsnprintf(s->buf + s->len, s->cap - s->len, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+      die("vsnprintf failed\n");
+    if (s->len + n < s->cap)
+      break;
+    s->cap = MAX(s->cap * 2, 4096);
+    s->buf = xrealloc(s->buf, s->cap);
+  }
+  s->len += n;
+}
+
+/* appends the file at path to s */
+static inline void slurp(Stream *s, const char *path) {
+  FILE *fp;
+  size_t n;
+
+  if (!(fp = fopen(path, "r")))
+    die("cannot open %s\n", path);
+  for (;;) {
+    if (s->len == s->cap) {
+      s->cap = MAX(s->cap * 2, BUFSIZ);
+      s->buf = xrealloc(s->buf, s->cap);
+    }
+    if ((n = fread(s->buf + s->len, 1, s->cap - s->len, fp)) == 0)
+      break;
+    s->len += n;
+  }
+  if (ferror(fp))
+    die("error reading %s\n", path);
+  fclose(fp);
+}
+
+/* a field of /proc/self/status, VmRSS or VmHWM for its peak */
+static inline long status(const char *field) {
+  char line[256];
+  size_t len = strlen(field);
+  long kb = 0;
+  FILE *fp;
+
+  if (!(fp = fopen("/proc/self/status", "r")))
+    return 0;
+  while (fgets(line, sizeof(line), fp)) {
+    if (!strncmp(line, field, len) && line[len] == ':') {
+      kb = atol(line + len + 1);
+      break;
+    }
+  }
+  fclose(fp);
+  return kb;
+}
+
+/* VmHWM starts over from the current RSS, 0 if the kernel won't */
+static inline int resetpeak(void) {
+  FILE *fp;
+  int ok;
+
+  if (!(fp = fopen("/proc/self/clear_refs", "w")))
+    return 0;
+  ok = fputs("5", fp) >= 0;
+  return !fclose(fp) && ok;
+}
+
+#endif
@@ -0,0 +1,118 @@
+/* See LICENSE for license details. */
+/*
+ * Keystroke latency under an output flood. A child floods a pty with
+ * coloured text while the main loop of run_pterminal() is replayed
+ * without a window: pending input first, then read_tty_until_idle(). A ^C
+ * is injected every few milliseconds and the time until it is written to
+ * the pty is reported. Drawing is left out, so frames cost nothing here.
+ * -u does the pty I/O through io_uring.
+ */
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "terminal.h"
+#include "selection.h"
+#include "tty.h"
+#include "bench.h"
+
+#include "config.h"
+
+/* a screenful of cells with their own colours, forever */
+static void flood(int fd) {
+  char buf[1 << 16];
+  int len = 0, i = 0;
+
+  while (len < sizeof(buf) - 64) {
+    len += snprintf(buf + len, sizeof(buf) - len, "\033[38;5;%d;48;5;%dm%c",
+                    i % 256, 255 - i % 256, 'A' + i % 26);
+    if (++i % 80 == 0)
+      len += snprintf(buf + len, sizeof(buf) - len, "\r\n");
+  }
+  for (;;)
+    if (write(fd, buf, len) < 0)
+      _exit(0);
+}
+
+static int compare(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void usage(const char *argv0) {
+  die("usage: %s [-u] [-b budget ms] [-n samples]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+  struct timespec trigger;
+  struct termios mode;
+  double *latency, inject, total = 0;
+  int c, i = 0, samples = 100, reading = 0, slave;
+  pid_t child;
+
+  while ((c = getopt(argc, argv, "ub:n:")) != -1) {
+    switch (c) {
+    case 'u': ttyuring = 1; break;
+    case 'b': parsebudget = atof(optarg); break;
+    case 'n': samples = MAX(atoi(optarg), 1); break;
+    default: usage(argv[0]);
+    }
+  }
+
+  if (openpty(&cmdfd, &slave, NULL, NULL, NULL) < 0)
+    die("openpty failed\n");
+  tcgetattr(slave, &mode);
+  cfmakeraw(&mode);
+  tcsetattr(slave, TCSANOW, &mode);
+
+  switch (child = fork()) {
+  case -1:
+    die("fork failed\n");
+  case 0:
+    close(cmdfd);
+    flood(slave);
+  }
+  close(slave);
+
+  new_terminal(80, 24);
+  selinit();
+  ttyinit();
+  latency = xmalloc(samples * sizeof(*latency));
+  srand(1);
+  inject = now() + (5 + rand() % 20) / 1E3;
+
+  while (i < samples) {
+    /* stands in for pway_handle_events() */
+    if (now() >= inject) {
+      write_to_tty("\003", 1, 0);
+      ttyflush();
+      latency[i] = now() - inject;
+      total += latency[i++];
+      inject = now() + (5 + rand() % 20) / 1E3;
+    }
+
+    if (!reading) {
+      clock_gettime(CLOCK_MONOTONIC, &trigger);
+      reading = 1;
+    }
+    if (read_tty_until_idle(&trigger))
+      reading = 0; /* draw() would run here */
+  }
+  kill(child, SIGKILL);
+
+  qsort(latency, samples, sizeof(*latency), compare);
+  printf("%s, parse budget %.1f ms, %d samples: ^C latency %.2f ms mean, "
+         "%.2f ms median, %.2f ms max\n",
+         ttyuring ? "io_uring" : "read/write", parsebudget, samples,
+         total * 1E3 / samples, latency[samples / 2] * 1E3,
+         latency[samples - 1] * 1E3);
+
+  return 0;
+}
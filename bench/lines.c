@@ -0,0 +1,71 @@
+/* See LICENSE for license details. */
+/*
+ * Line allocation. Scrolls a screenful of coloured text at a time, and
+ * between screens widens the window by a column, the way an interactive
+ * resize does, so the lines of the screen are reallocated. Every 40 screens
+ * the terminal is reset to its first width. Reports throughput and RSS
+ * for the line allocator picked with -a (lineslab in config.h).
+ */
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "terminal.h"
+#include "selection.h"
+#include "bench.h"
+
+#include "config.h"
+
+static void usage(const char *argv0) {
+  die("usage: %s [-a lineslab] [-c cols] [-r rows] [-n screens]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+  char buf[64];
+  double t;
+  long bytes = 0;
+  int c, i, y, x, n, screens = 2000, bcols = 80, brows = 24;
+
+  while ((c = getopt(argc, argv, "a:c:r:n:")) != -1) {
+    switch (c) {
+    case 'a': lineslab = atoi(optarg); break;
+    case 'c': bcols = MAX(atoi(optarg), 2); break;
+    case 'r': brows = MAX(atoi(optarg), 1); break;
+    case 'n': screens = MAX(atoi(optarg), 1); break;
+    default: usage(argv[0]);
+    }
+  }
+
+  new_terminal(bcols, brows);
+  selinit();
+  srand(1);
+
+  t = now();
+  for (i = 0; i < screens; i++) {
+    for (y = 0; y < brows; y++) {
+      for (x = 0; x < term.col; x += 8) {
+        n = snprintf(buf, sizeof(buf), "\033[38;5;%dm%.8s", rand() % 256,
+                     "abcdefgh");
+        bytes += n;
+        twrite(buf, n, 0);
+      }
+      twrite("\r\n", 2, 0);
+      bytes += 2;
+    }
+    if (i % 40 == 39) {
+      resize_terminal(bcols, brows);
+      twrite("\033c", 2, 0);
+    } else {
+      resize_terminal(term.col + 1, brows);
+    }
+  }
+  t = now() - t;
+
+  printf("lineslab %d, %d screens of %dx%d resized in between: "
+         "%.2f MB/s, %ld KB rss, %ld KB peak rss\n",
+         lineslab, screens, bcols, brows, bytes / t / 1E6, status("VmRSS"),
+         status("VmHWM"));
+  return 0;
+}
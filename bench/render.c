@@ -0,0 +1,159 @@
+/* See LICENSE for license details. */
+/*
+ * Frame time of the renderer on an offscreen EGL surface. Run it with
+ * LIBGL_ALWAYS_SOFTWARE=1 to measure llvmpipe. Every frame scrolls a new
+ * line of coloured text in, or with -t types a single character, is
+ * published and drawn with draw_terminal() like draw() does minus the
+ * buffer swap. -g selects the fragment shader grid.
+ */
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+
+#include "terminal.h"
+#include "window.h"
+#include "draw.h"
+#include "opengl.h"
+#include "gridshader.h"
+#include "selection.h"
+#include "snapshot.h"
+#include "bench.h"
+
+#include "config.h"
+
+TerminalWindow terminal_window;
+
+static void init_egl(int width, int height) {
+  static const EGLint config_attributes[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+    EGL_NONE
+  };
+  EGLint surface_attributes[] = {
+    EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE
+  };
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+  EGLDisplay display = EGL_NO_DISPLAY;
+  EGLConfig config;
+  EGLContext context;
+  EGLSurface surface;
+  EGLint n;
+
+  get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+      "eglGetPlatformDisplayEXT");
+  if (get_platform_display)
+    display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                   EGL_DEFAULT_DISPLAY, NULL);
+  if (display == EGL_NO_DISPLAY)
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+  if (!eglInitialize(display, NULL, NULL))
+    die("eglInitialize failed\n");
+  eglBindAPI(EGL_OPENGL_API);
+  if (!eglChooseConfig(display, config_attributes, &config, 1, &n) || n < 1)
+    die("no pbuffer capable EGL config\n");
+  context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+  surface = eglCreatePbufferSurface(display, config, surface_attributes);
+  if (context == EGL_NO_CONTEXT || surface == EGL_NO_SURFACE ||
+      !eglMakeCurrent(display, surface, surface, context))
+    die("cannot create an offscreen GL context\n");
+}
+
+/* a screenful of coloured text, scrolled by a line per call */
+static void fill(void) {
+  char buf[64];
+  int i, n;
+
+  for (i = 0; i < term.col; i++) {
+    n = snprintf(buf, sizeof(buf), "\033[38;5;%d;48;5;%dm%c", rand() % 256,
+                 rand() % 16, '!' + rand() % 94);
+    twrite(buf, n, 0);
+  }
+  twrite("\033[m\r\n", 5, 0);
+}
+
+/* a single character somewhere in the current line */
+static void type(void) {
+  char buf[64];
+  int n;
+
+  n = snprintf(buf, sizeof(buf), "\033[%dG\033[3%dm%c", 1 + rand() % term.col,
+               rand() % 8, 'a' + rand() % 26);
+  twrite(buf, n, 0);
+}
+
+static void usage(const char *argv0) {
+  die("usage: %s [-gt] [-c cols] [-r rows] [-n frames]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+  int c, i, frames = 100, typing = 0;
+  int bcols = 200, brows = 60;
+  double t, total = 0, best = 0;
+
+  while ((c = getopt(argc, argv, "gtc:r:n:")) != -1) {
+    switch (c) {
+    case 'g': gpugrid = 1; break;
+    case 't': typing = 1; break;
+    case 'c': bcols = MAX(atoi(optarg), 1); break;
+    case 'r': brows = MAX(atoi(optarg), 1); break;
+    case 'n': frames = MAX(atoi(optarg), 1); break;
+    default: usage(argv[0]);
+    }
+  }
+
+  /* same metrics as create_window() */
+  terminal_window.character_height = 24;
+  terminal_window.character_gl_width = 32;
+  terminal_window.character_gl_height = 32;
+  terminal_window.character_width = 9;
+  terminal_window.width = bcols * terminal_window.character_width;
+  terminal_window.height = brows * terminal_window.character_height;
+  terminal_window.mode = MODE_VISIBLE | MODE_FOCUSED;
+  terminal_window.cursor = cursorshape;
+
+  init_egl(terminal_window.width, terminal_window.height);
+  set_ortho_projection(terminal_window.width, terminal_window.height);
+  glViewport(0, 0, terminal_window.width, terminal_window.height);
+  load_font_image(&font_texture_id);
+  xloadcols();
+  if (gpugrid && !grid_init())
+    die("cannot build the grid shader\n");
+
+  new_terminal(bcols, brows);
+  selinit();
+  srand(1);
+  for (i = 0; i < brows; i++)
+    fill();
+
+  snapshot_publish(terminal_window.mode, terminal_window.cursor);
+  draw_terminal();
+
+  for (i = 0; i < frames; i++) {
+    if (typing)
+      type();
+    else
+      fill();
+    t = now();
+    snapshot_publish(terminal_window.mode, terminal_window.cursor);
+    draw_terminal();
+    glFinish();
+    t = now() - t;
+    total += t;
+    if (i == 0 || t < best)
+      best = t;
+  }
+
+  printf("%s\n", glGetString(GL_RENDERER));
+  printf("%s, %s, %dx%d cells, %d frames: %.2f ms/frame mean, %.2f ms best\n",
+         gpugrid ? "grid shader" : "quads", typing ? "typing" : "scrolling",
+         term.col, term.row, frames, total * 1E3 / frames, best * 1E3);
+
+  return 0;
+}
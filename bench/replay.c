@@ -0,0 +1,180 @@
+/* See LICENSE for license details. */
+/*
+ * Headless replay benchmark. Feeds byte streams through twrite() the same
+ * way read_tty() does and reports parser throughput and RSS. All frontend
+ * callbacks are left at their defaults. Without arguments a
+ * set of generated vtebench style cases is replayed, otherwise every
+ * argument is a recorded stream (e.g. from script(1)). -a sets lineslab
+ * from config.h, to compare line allocators.
+ */
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "terminal.h"
+#include "selection.h"
+#include "utf8.h"
+#include "bench.h"
+
+#include "config.h"
+
+static int bcols = 80, brows = 24;
+
+static void sputrune(Stream *s, Rune u) {
+  char c[UTF_SIZ];
+
+  c[utf8encode(u, c)] = '\0';
+  sput(s, "%s", c);
+}
+
+/* every cell gets its own colours and attributes */
+static void gen_dense(Stream *s, size_t size) {
+  int x, y, i = 0;
+
+  while (s->len < size) {
+    sput(s, "\033[H");
+    for (y = 0; y < brows; y++) {
+      for (x = 0; x < bcols; x++, i++)
+        sput(s, "\033[%d;38;5;%d;48;5;%dm%c", i % 2 ? 1 : 4, i % 256,
+             255 - i % 256, 'A' + i % 26);
+      if (y < brows - 1)
+        sput(s, "\r\n");
+    }
+  }
+  sput(s, "\033[m");
+}
+
+/* plain lines of varying length, one per newline */
+static void gen_scroll(Stream *s, size_t size) {
+  int n, i = 0;
+
+  while (s->len < size) {
+    n = rand() % bcols;
+    for (; n > 0; n--, i++)
+      sput(s, "%c", ' ' + i % 95);
+    sput(s, "\r\n");
+  }
+}
+
+/* as above but inside a scroll region that excludes the top line */
+static void gen_region(Stream *s, size_t size) {
+  sput(s, "\033[2;%dr\033[%dH", brows, brows);
+  gen_scroll(s, size);
+  sput(s, "\033[r");
+}
+
+/* CJK, accented latin, box drawing and emoji */
+static void gen_unicode(Stream *s, size_t size) {
+  static const Rune ranges[][2] = {
+    {0x4E00, 0x9FFF}, {0x00C0, 0x017F}, {0x2500, 0x257F}, {0x1F300, 0x1F64F},
+  };
+  int n, r;
+
+  while (s->len < size) {
+    r = rand() % LEN(ranges);
+    for (n = rand() % bcols; n > 0; n--)
+      sputrune(s, ranges[r][0] + rand() % (ranges[r][1] - ranges[r][0] + 1));
+    sput(s, "\r\n");
+  }
+}
+
+/* absolute and relative cursor movement with a single cell printed */
+static void gen_cursor(Stream *s, size_t size) {
+  while (s->len < size) {
+    sput(s, "\033[%d;%dH%c", 1 + rand() % brows, 1 + rand() % bcols,
+         'a' + rand() % 26);
+    sput(s, "\033[%dC\033[%dA%c", rand() % 8, rand() % 4, 'A' + rand() % 26);
+  }
+}
+
+/* hand out BUFSIZ at a time and keep partial sequences, like read_tty() */
+static double replay(const Stream *s) {
+  const char *p = s->buf, *end = s->buf + s->len;
+  double t0;
+  int n;
+
+  t0 = now();
+  while (p < end) {
+    n = twrite(p, MIN(end - p, BUFSIZ), 0);
+    if (n == 0)
+      break;
+    p += n;
+  }
+  return now() - t0;
+}
+
+/*
+ * RSS is taken with the stream already in memory, and the peak is that of
+ * this case alone where the kernel can reset it, of the process otherwise.
+ */
+static void run(const char *name, const Stream *s, int loops) {
+  long rss = status("VmRSS");
+  int fresh = resetpeak();
+  double t, best = 0;
+  int i;
+
+  for (i = 0; i < loops; i++) {
+    twrite("\033c", 2, 0);
+    t = replay(s);
+    if (i == 0 || t < best)
+      best = t;
+  }
+  printf("%-14s %9.2f MB/s %8.2f ns/byte %8ld KB rss %8ld KB peak rss%s\n",
+         name, s->len / best / 1E6, best * 1E9 / s->len, rss, status("VmHWM"),
+         fresh ? "" : " (whole run)");
+}
+
+static void usage(const char *argv0) {
+  die("usage: %s [-a lineslab] [-c cols] [-r rows] [-s megabytes] [-n loops] "
+      "[file ...]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+  static const struct {
+    const char *name;
+    void (*gen)(Stream *, size_t);
+  } cases[] = {
+    {"dense_cells", gen_dense},     {"scrolling", gen_scroll},
+    {"scroll_region", gen_region},  {"unicode", gen_unicode},
+    {"cursor_motion", gen_cursor},
+  };
+  size_t size = 16 << 20;
+  Stream s;
+  int c, i, loops = 3;
+
+  while ((c = getopt(argc, argv, "a:c:r:s:n:")) != -1) {
+    switch (c) {
+    case 'a': lineslab = atoi(optarg); break;
+    case 'c': bcols = MAX(atoi(optarg), 1); break;
+    case 'r': brows = MAX(atoi(optarg), 1); break;
+    case 's': size = MAX(atoi(optarg), 1) << 20; break;
+    case 'n': loops = MAX(atoi(optarg), 1); break;
+    default: usage(argv[0]);
+    }
+  }
+
+  new_terminal(bcols, brows);
+  selinit();
+
+  if (optind < argc) {
+    for (i = optind; i < argc; i++) {
+      s = (Stream){0};
+      slurp(&s, argv[i]);
+      if (s.len)
+        run(argv[i], &s, loops);
+      free(s.buf);
+    }
+    return 0;
+  }
+
+  for (i = 0; i < LEN(cases); i++) {
+    srand(1);
+    s = (Stream){0};
+    cases[i].gen(&s, size);
+    run(cases[i].name, &s, loops);
+    free(s.buf);
+  }
+  return 0;
+}
@@ -0,0 +1,138 @@
+/* See LICENSE for license details. */
+/*
+ * Scrollback memory. Replays a build log through twrite() until the lines
+ * scrolled past the ring are packed, then reports what a line costs
+ * expanded in the ring and packed in history.c, and how long reading the
+ * packed lines back takes. Without arguments a make style log with
+ * coloured gcc diagnostics is generated, otherwise every argument is a
+ * recorded stream (e.g. make 2>&1 | tee log, with -fdiagnostics-color).
+ */
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "terminal.h"
+#include "selection.h"
+#include "history.h"
+#include "bench.h"
+
+#include "config.h"
+
+/* compile commands, now and then a warning with its source excerpt */
+static void gen_build(Stream *s, size_t size) {
+  static const char *dirs[] = {"src", "src/core", "lib/util", "drivers/net"};
+  static const char *words[] = {"buffer", "state", "count", "index", "node",
+                                "entry", "len", "flags", "ctx", "table"};
+  static const char *warnings[] = {
+    "unused variable", "comparison of integer expressions of different "
+    "signedness", "implicit conversion changes signedness",
+    "this statement may fall through",
+  };
+  const char *dir, *w;
+  int file, line, col;
+
+  while (s->len < size) {
+    dir = dirs[rand() % LEN(dirs)];
+    file = rand() % 400;
+    sput(s, "gcc -O2 -g -Wall -Wextra -fPIC -Iinclude -I%s -DNDEBUG "
+         "-c %s/%s_%d.c -o build/%s/%s_%d.o\r\n", dir, dir,
+         words[file % LEN(words)], file, dir, words[file % LEN(words)], file);
+    if (rand() % 4)
+      continue;
+
+    w = words[rand() % LEN(words)];
+    line = 10 + rand() % 2000;
+    col = 5 + rand() % 40;
+    sput(s, "\033[01m\033[K%s/%s_%d.c:\033[m\033[K In function "
+         "'\033[01m\033[K%s_update\033[m\033[K':\r\n", dir,
+         words[file % LEN(words)], file, w);
+    sput(s, "\033[01m\033[K%s/%s_%d.c:%d:%d:\033[m\033[K \033[01;35m\033[K"
+         "warning: \033[m\033[K%s '\033[01m\033[K%s\033[m\033[K' "
+         "[\033[01;35m\033[K-Wextra\033[m\033[K]\r\n", dir,
+         words[file % LEN(words)], file, line, col,
+         warnings[rand() % LEN(warnings)], w);
+    sput(s, " %4d |   for (i = 0; i < %s->%s; i++)\r\n", line, w,
+         words[rand() % LEN(words)]);
+    sput(s, "      | %*s\033[01;35m\033[K^~~~~\033[m\033[K\r\n", col, "");
+  }
+}
+
+static void run(const char *name, const Stream *s) {
+  const char *p = s->buf, *end = s->buf + s->len;
+  size_t packed, bytes;
+  double t, replay;
+  int i, n, lines;
+
+  twrite("\033c", 2, 0);
+  t = now();
+  while (p < end) {
+    if ((n = twrite(p, MIN(end - p, BUFSIZ), 0)) == 0)
+      break;
+    p += n;
+  }
+  history_sync();
+  replay = now() - t;
+
+  if (!(packed = history_packed(&bytes))) {
+    printf("%-14s too short, nothing scrolled far enough to be packed\n",
+           name);
+    return;
+  }
+  lines = history_count();
+  t = now();
+  for (i = 0; i < lines; i++)
+    history_line(i);
+  t = now() - t;
+
+  printf("%-14s %9zu lines packed, %6.1f MB/s replayed\n", name, packed,
+         s->len / replay / 1E6);
+  printf("%-14s %9zu B/line expanded, %6.1f B/line packed (%.0fx), "
+         "%.0f ns/line to read back\n", "",
+         term.linelen * sizeof(PGlyph), (double)bytes / packed,
+         term.linelen * sizeof(PGlyph) * packed / (double)bytes,
+         t * 1E9 / lines);
+}
+
+static void usage(const char *argv0) {
+  die("usage: %s [-c cols] [-r rows] [-s megabytes] [file ...]\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+  size_t size = 16 << 20;
+  int c, i, bcols = 80, brows = 24;
+  Stream s;
+
+  while ((c = getopt(argc, argv, "c:r:s:")) != -1) {
+    switch (c) {
+    case 'c': bcols = MAX(atoi(optarg), 1); break;
+    case 'r': brows = MAX(atoi(optarg), 1); break;
+    case 's': size = MAX(atoi(optarg), 1) << 20; break;
+    default: usage(argv[0]);
+    }
+  }
+
+  /* keep everything, the point is to see what it costs */
+  histlines = histmem = -1;
+  new_terminal(bcols, brows);
+  selinit();
+
+  if (optind < argc) {
+    for (i = optind; i < argc; i++) {
+      s = (Stream){0};
+      slurp(&s, argv[i]);
+      if (s.len)
+        run(argv[i], &s);
+      free(s.buf);
+    }
+    return 0;
+  }
+
+  srand(1);
+  s = (Stream){0};
+  gen_build(&s, size);
+  run("build_log", &s);
+  free(s.buf);
+  return 0;
+}
@@ -0,0 +1,102 @@
+/* See LICENSE for license details. */
+/*
+ * Compares decoding pty output one rune at a time with utf8decode(), as
+ * twrite() used to, against utf8decodebuf() in batches of the size twrite()
+ * uses now, on the same generated text. Both must produce the same runes.
+ */
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utf8.h"
+#include "bench.h"
+
+#define NBYTES (1 << 24)
+#define BATCH 1024 /* TWRITE_RUNES in terminal.c */
+
+static char text[NBYTES + UTF_SIZ];
+static Rune runes[NBYTES];
+
+/* words out of pool until the buffer is full, a newline now and then */
+static void fill(const char *const *pool, int n) {
+  size_t len, i = 0;
+  const char *w;
+
+  srand(1);
+  while (i < NBYTES) {
+    w = rand() % 12 ? pool[rand() % n] : "\r\n";
+    len = strlen(w);
+    if (i + len > NBYTES)
+      break;
+    memcpy(text + i, w, len);
+    i += len;
+  }
+  memset(text + i, ' ', NBYTES - i);
+}
+
+/* bytes of a random sequence, mostly invalid UTF-8 */
+static void fillrandom(void) {
+  size_t i;
+
+  srand(1);
+  for (i = 0; i < NBYTES; i++)
+    text[i] = rand();
+}
+
+static void run(const char *name) {
+  size_t i, n, len, count, a = 0, b = 0;
+  unsigned long suma = 0, sumb = 0;
+  double t0, t1, t2;
+  Rune u;
+
+  t0 = now();
+  for (i = 0; i < NBYTES; i += len) {
+    if ((len = utf8decode(text + i, &u, NBYTES - i)) == 0)
+      break;
+    suma += u;
+    a++;
+  }
+  t1 = now();
+  for (i = 0; i < NBYTES; i += len) {
+    count = BATCH;
+    if ((len = utf8decodebuf(text + i, NBYTES - i, runes, &count)) == 0)
+      break;
+    for (n = 0; n < count; n++)
+      sumb += runes[n];
+    b += count;
+  }
+  t2 = now();
+
+  printf("%-8s utf8decode %7.1f MB/s  utf8decodebuf %7.1f MB/s  (%zu/%zu "
+         "runes%s)\n", name, NBYTES / (t1 - t0) / 1E6,
+         NBYTES / (t2 - t1) / 1E6, a, b,
+         a == b && suma == sumb ? "" : ", MISMATCH");
+}
+
+int main(void) {
+  static const char *const build[] = {
+    "gcc ", "-O2 ", "-Wall ", "-c ", "src/core/buffer.c ", "-o ",
+    "build/buffer.o ", "-Iinclude ", "warning: ", "unused variable ",
+    "'count' ", "[-Wunused-variable] ", "    ", "| ", "^~~~~ ",
+  };
+  static const char *const box[] = {
+    "“quoted” ", "it’s ", "— ", "… ", "┌──────┐", "│ ", "└──────┘",
+    "├─", "plain ", "words ", "café ", "naïve ", "→ ", "• ",
+  };
+  static const char *const cjk[] = {
+    "日本語", "の", "テキスト", "中文", "文本", "한국어", "텍스트", "、",
+    "。", "漢字", "かな", "カナ", " ",
+  };
+
+  fill(build, LEN(build));
+  run("ascii");
+  fill(box, LEN(box));
+  run("box");
+  fill(cjk, LEN(cjk));
+  run("cjk");
+  fillrandom();
+  run("random");
+
+  return 0;
+}
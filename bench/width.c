@@ -0,0 +1,58 @@
+/* See LICENSE for license details. */
+/*
+ * Compares runewidth() against the C library wcwidth() on rune streams
+ * typical for CJK text and emoji heavy output.
+ */
+#define _XOPEN_SOURCE 700
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+
+#include "runewidth.h"
+#include "bench.h"
+
+#define NRUNES (1 << 22)
+
+static Rune runes[NRUNES];
+
+/* mostly random code points out of [lo, hi], one in ten ASCII */
+static void fill(Rune lo, Rune hi) {
+  int i;
+
+  srand(1);
+  for (i = 0; i < NRUNES; i++)
+    runes[i] = (rand() % 10) ? lo + rand() % (hi - lo + 1) : ' ' + rand() % 95;
+}
+
+static void run(const char *name) {
+  double t0, t1, t2;
+  long a = 0, b = 0;
+  int i, w;
+
+  t0 = now();
+  for (i = 0; i < NRUNES; i++)
+    if ((w = wcwidth(runes[i])) > 0)
+      a += w;
+  t1 = now();
+  for (i = 0; i < NRUNES; i++)
+    b += runewidth(runes[i]);
+  t2 = now();
+
+  printf("%-8s wcwidth %6.2f ns/rune  runewidth %6.2f ns/rune  (%ld/%ld cols)\n",
+         name, (t1 - t0) * 1E9 / NRUNES, (t2 - t1) * 1E9 / NRUNES, a, b);
+}
+
+int main(void) {
+  if (!setlocale(LC_CTYPE, "C.UTF-8") && !setlocale(LC_CTYPE, ""))
+    fprintf(stderr, "no UTF-8 locale, wcwidth() results are meaningless\n");
+
+  fill(0x4E00, 0x9FFF);
+  run("cjk");
+  fill(0x1F300, 0x1F64F);
+  run("emoji");
+  fill(0x2500, 0x257F);
+  run("box");
+
+  return 0;
+}
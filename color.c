@@ -1,3 +1,4 @@
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include "color.h"
@@ -43,13 +44,29 @@ const uint32_t my_colors[] = {
 
 
 /*
- * Default colors (colorname index)
- * foreground, background, cursor, reverse cursor
+ * What get_color() resolved lately, by fg, bg and the attributes that
+ * change the result. Both this and the float palette are rebuilt by the
+ * renderer once palette_version moved, which xloadcols() and
+ * xsetcolorname() do.
  */
-unsigned int defaultfg = 258;
-unsigned int defaultbg = 259;
-unsigned int defaultcs = 256;
-
+#define COLOR_CACHE_BITS 10
+#define COLOR_CACHE_SIZE (1 << COLOR_CACHE_BITS)
+#define COLOR_CACHE_SAMPLE 4096 /* lookups the miss rate is taken over */
+#define COLOR_CACHE_SKIP 65536  /* lookups to resolve directly after that */
+#define COLOR_ATTRS                                                            \
+  (ATTR_BOLD | ATTR_FAINT | ATTR_REVERSE | ATTR_BLINK | ATTR_INVISIBLE)
+
+typedef struct {
+  uint32_t fg, bg;
+  int key; /* mode & COLOR_ATTRS with the window flags, -1 when unused */
+  PColor gl_foreground_color, gl_background_color;
+} CachedColor;
+
+static CachedColor color_cache[COLOR_CACHE_SIZE];
+static unsigned cache_lookups, cache_misses, cache_skip;
+static PColor *palette; /* drawing_context.colors as GL floats */
+static atomic_uint palette_version = 1;
+static unsigned palette_built;
 
 ushort sixd_to_16bit(int x) { return x == 0 ? 0 : 0x3737 + 0x2828 * x; }
 
@@ -123,6 +140,7 @@ void xloadcols(void) {
     xloadcolor(i, NULL, &drawing_context.colors[i]);
 
   loaded = 1;
+  palette_version++;
 }
 
 int xgetcolor(int x, unsigned char *r, unsigned char *g, unsigned char *b) {
@@ -149,43 +167,65 @@ int xsetcolorname(int x, const char *name) {
     return 1;
 
   drawing_context.colors[x] = ncolor;
+  palette_version++;
 
   return 0;
 }
 
-void get_color_from_glyph(PGlyph* base, RenderColor* out){
+static PColor to_gl(const Color *c) {
+  float div;
+
+  if (c->color.red > 255 || c->color.blue > 255 || c->color.green > 255) {
+    div = 65535.f;
+  } else {
+    div = 255.f;
+  }
+  return (PColor){.r = c->color.red / div,
+                  .g = c->color.green / div,
+                  .b = c->color.blue / div};
+}
+
+/* palette entries come from the float palette, the rest are converted */
+static PColor gl_color(const Color *c) {
+  if (c >= drawing_context.colors &&
+      c < drawing_context.colors + drawing_context.colors_count)
+    return palette[c - drawing_context.colors];
+  return to_gl(c);
+}
+
+static void resolve_color(Style style, int mode, RenderColor *out) {
 
   Color *fg, *bg, *temp;
   TRenderColor colfg, colbg;
 
 
-  if (IS_TRUECOL(base->fg)) {
+  if (IS_TRUECOL(style.fg)) {
     colfg.alpha = 0xffff;
-    colfg.red = TRUERED(base->fg);
-    colfg.green = TRUEGREEN(base->fg);
-    colfg.blue = TRUEBLUE(base->fg);
+    colfg.red = TRUERED(style.fg);
+    colfg.green = TRUEGREEN(style.fg);
+    colfg.blue = TRUEBLUE(style.fg);
     memcpy(&out->truefg.color,&colfg,sizeof(TRenderColor));
     fg = &out->truefg;
   } else {
-    fg = &drawing_context.colors[base->fg];
+    fg = &drawing_context.colors[style.fg];
   }
 
-  if (IS_TRUECOL(base->bg)) {
+  if (IS_TRUECOL(style.bg)) {
     colbg.alpha = 0xffff;
-    colbg.green = TRUEGREEN(base->bg);
-    colbg.red = TRUERED(base->bg);
-    colbg.blue = TRUEBLUE(base->bg);
+    colbg.green = TRUEGREEN(style.bg);
+    colbg.red = TRUERED(style.bg);
+    colbg.blue = TRUEBLUE(style.bg);
     memcpy(&out->truebg.color,&colbg,sizeof(TRenderColor));
     bg = &out->truebg;
   } else {
-    bg = &drawing_context.colors[base->bg];
+    bg = &drawing_context.colors[style.bg];
   }
 
   /* Change basic system colors [0-7] to bright system colors [8-15] */
-  if ((base->mode & ATTR_BOLD_FAINT) == ATTR_BOLD && BETWEEN(base->fg, 0, 7))
-    fg = &drawing_context.colors[base->fg + 8];
+  if ((mode & ATTR_BOLD_FAINT) == ATTR_BOLD && BETWEEN(style.fg, 0, 7))
+    fg = &drawing_context.colors[style.fg + 8];
 
-  if (IS_WINDOSET(MODE_REVERSE)) {
+  if (IS_DRAWSET(MODE_REVERSE)) {
     if (fg == &drawing_context.colors[defaultfg]) {
       fg = &drawing_context.colors[defaultbg];
     } else {
@@ -209,7 +249,7 @@ void get_color_from_glyph(PGlyph* base, RenderColor* out){
     }
   }
 
-  if ((base->mode & ATTR_BOLD_FAINT) == ATTR_FAINT) {
+  if ((mode & ATTR_BOLD_FAINT) == ATTR_FAINT) {
     colfg.red = fg->color.red / 2;
     colfg.green = fg->color.green / 2;
     colfg.blue = fg->color.blue / 2;
@@ -218,43 +258,72 @@ void get_color_from_glyph(PGlyph* base, RenderColor* out){
     fg = &out->revfg;
   }
 
-  if (base->mode & ATTR_REVERSE) {
+  if (mode & ATTR_REVERSE) {
     temp = fg;
     fg = bg;
     bg = temp;
   }
 
-  if (base->mode & ATTR_BLINK && terminal_window.mode & MODE_BLINK)
+  if (mode & ATTR_BLINK && IS_DRAWSET(MODE_BLINK))
     fg = bg;
 
-  if (base->mode & ATTR_INVISIBLE)
+  if (mode & ATTR_INVISIBLE)
     fg = bg;
 
-  // opengl convertion
-  float div;
+  out->gl_background_color = gl_color(bg);
+  out->gl_foreground_color = gl_color(fg);
+}
 
-  if (bg->color.red > 255 || bg->color.blue > 255 || bg->color.green > 255) {
-    div = 65525.f;
-  } else {
-    div = 255.f;
+/* colours of a glyph with the given style and attributes */
+void get_color(Style style, int mode, RenderColor *out) {
+  unsigned version = palette_version;
+  CachedColor *c;
+  uint32_t h;
+  size_t i;
+  int key;
+
+  if (palette_built != version) {
+    palette = xrealloc(palette, drawing_context.colors_count * sizeof(*palette));
+    for (i = 0; i < drawing_context.colors_count; i++)
+      palette[i] = to_gl(&drawing_context.colors[i]);
+    for (i = 0; i < COLOR_CACHE_SIZE; i++)
+      color_cache[i].key = -1;
+    palette_built = version;
   }
 
-  PColor background = {.r = bg->color.red / div,
-                       .g = bg->color.green / div,
-                       .b = bg->color.blue / div};
-
-  if (fg->color.red > 255 || fg->color.blue > 255 || fg->color.green > 255) {
-    div = 65525.f;
-  } else {
-    div = 255.f;
+  if (cache_skip) {
+    cache_skip--;
+    resolve_color(style, mode, out);
+    return;
   }
 
-  PColor foreground = {.r = fg->color.red / div,
-                       .g = fg->color.green / div,
-                       .b = fg->color.blue / div};
-
-  
-  out->gl_background_color = background;
-  out->gl_foreground_color = foreground;
+  key = mode & COLOR_ATTRS;
+  if (IS_DRAWSET(MODE_REVERSE))
+    key |= 1 << 12;
+  if (IS_DRAWSET(MODE_BLINK))
+    key |= 1 << 13;
+
+  h = style.fg * 0x9E3779B1u ^ style.bg * 0x85EBCA6Bu ^ key;
+  h ^= h >> 15;
+  h *= 0xC2B2AE35u;
+  c = &color_cache[h >> (32 - COLOR_CACHE_BITS)];
+  if (++cache_lookups == COLOR_CACHE_SAMPLE) {
+    /* more pairs on screen than fit, the misses cost more than hits save */
+    if (cache_misses > COLOR_CACHE_SAMPLE / 2)
+      cache_skip = COLOR_CACHE_SKIP;
+    cache_lookups = cache_misses = 0;
+  }
+  if (c->key == key && c->fg == style.fg && c->bg == style.bg) {
+    out->gl_foreground_color = c->gl_foreground_color;
+    out->gl_background_color = c->gl_background_color;
+    return;
+  }
+  cache_misses++;
+  resolve_color(style, mode, out);
+  *c = (CachedColor){style.fg, style.bg, key, out->gl_foreground_color,
+                     out->gl_background_color};
+}
 
+void get_color_from_glyph(PGlyph* base, RenderColor* out){
+  get_color(GLYPHSTYLE(*base), base->mode, out);
 }
@@ -4,13 +4,6 @@
 #include <GL/gl.h>
 #include "terminal.h"
 
-#define TRUERED(x) (((x) & 0xff0000) >> 8)
-#define TRUEGREEN(x) (((x) & 0xff00))
-#define TRUEBLUE(x) (((x) & 0xff) << 8)
-
-#define TRUECOLOR(r, g, b) (1 << 24 | (r) << 16 | (g) << 8 | (b))
-#define IS_TRUECOL(x) (1 << 24 & (x))
-
 typedef struct PColor{
   GLfloat r;
   GLfloat g;
@@ -38,6 +31,7 @@ typedef struct RenderColor{
 }RenderColor;
 
 
+void get_color(Style style, int mode, RenderColor *out);
 void get_color_from_glyph(PGlyph* base, RenderColor* out);
 
 int xgetcolor(int x, unsigned char *r, unsigned char *g, unsigned char *b);
@@ -54,6 +54,14 @@ char *termname = "st-256color";
  */
 unsigned int tabspaces = 8;
 
+/*
+ * Default colors (colorname index)
+ * foreground, background, cursor, reverse cursor
+ */
+unsigned int defaultfg = 258;
+unsigned int defaultbg = 259;
+unsigned int defaultcs = 256;
+
 /*
  * Default shape of cursor
  * 2: Block ("█")
@@ -63,6 +71,75 @@ unsigned int tabspaces = 8;
  */
 static unsigned int cursorshape = 2;
 
+/*
+ * 1: keep the cells in a texture, upload only changed rows and draw the
+ *    grid with one fragment shader pass (needs GLSL 1.20)
+ * 0: draw every cell as a textured quad
+ */
+int gpugrid = 0;
+
+/*
+ * draw latency range in ms - from new content/keypress/etc until drawing.
+ * within this range, pterminal draws when content stops arriving (idle).
+ * mostly it's near minlatency, but it waits longer for slow updates to
+ * avoid partial draw. low minlatency will tear/flicker more, as it can
+ * "detect" idle too early.
+ */
+double minlatency = 2;
+double maxlatency = 33;
+
+/*
+ * Longest time in ms spent parsing output before pending keyboard input is
+ * handled again, so ^C lands quickly while a program floods the terminal
+ */
+double parsebudget = 4;
+
+/*
+ * Synchronized-Update timeout in ms
+ * https://gitlab.com/gnachman/iterm2/-/wikis/synchronized-updates-spec
+ */
+unsigned int synctimeout = 200;
+
+/*
+ * 1: read and parse the pty on a thread of its own, so a slow buffer swap
+ *    never holds up draining the child's output
+ * 0: read, parse and draw in turn on the main thread
+ */
+int parsethread = 0;
+
+/*
+ * 1: do pty I/O through io_uring, a read stays queued and output goes in
+ *    one write per flush, falling back to 0 when the kernel refuses
+ * 0: poll(), read() and write()
+ */
+int ttyuring = 0;
+
+/*
+ * File the counters are appended to on SIGUSR1 and at exit, NULL for
+ * stderr
+ */
+char *statsfile = NULL;
+
+/*
+ * 2: lines cut from 2 MB slabs advised as transparent huge pages
+ * 1: lines cut from 2 MB slabs, freed ones reused from a list per width
+ * 0: every line malloc()ed on its own, the default: slabs are never given
+ *    back to the system
+ */
+int lineslab = 0;
+
+/*
+ * Lines of scrollback, -l on the command line. Lines past the newest
+ * RINGHIST are packed and take memory as they come, see history.c
+ */
+unsigned int histlines = 100000;
+
+/*
+ * MB of packed scrollback kept past the line ring, the oldest lines go
+ * first once it is full
+ */
+unsigned int histmem = 64;
+
 /*
  * Default columns and rows numbers
  */
@@ -2,9 +2,13 @@
 #include "terminal.h"
 #include "window.h"
 #include "opengl.h"
+#include "gridshader.h"
 #include <stdbool.h>
+#include <stdio.h>
 #include "utf8.h"
 #include "selection.h"
+#include "stats.h"
+#include "snapshot.h"
 
 #include <pway/pway.h>
 
@@ -17,11 +21,30 @@ unsigned int cursorthickness = 2;
 
 bool can_update_size = false;
 
+/* what is drawn, the latest snapshot from draw_terminal() on */
+static const Snapshot *view;
+static uint64_t drawn_seq;
+static int old_cursor_x, old_cursor_y;
+
+/* frame in which each row last changed, see draw_changed_rows() */
+static unsigned int *row_changed;
+static int row_changed_count;
+static unsigned int frame;
+
+/* rows that changed in this frame, as EGL rectangles */
+static EGLint *damage;
+static int damage_count;
+
+/* runs of rows the grid shader redraws, first and end pairs */
+static int *grid_runs;
+static int grid_run_count;
+
 
 
 void swap_draw_buffers(){
-  
-  pway_swap_buffers();
+
+  if (!gl_swap_buffers_with_damage(damage, damage_count))
+    pway_swap_buffers();
 }
 
 void update_size() {
@@ -42,11 +65,20 @@ void init_draw_method(){
 
   pway_init_egl();
 
+  /*
+   * No frame callbacks, pway keeps the wl_surface to itself. Frames are
+   * paced by EGL's default swap interval of 1 alone: Mesa's Wayland
+   * platform blocks eglSwapBuffers() until the previous frame's callback.
+   */
 
   set_ortho_projection(terminal_window.width, terminal_window.height);
   glViewport(0, 0, terminal_window.width, terminal_window.height);
   load_font_image(&font_texture_id);
 
+  if (gpugrid && !grid_init()) {
+    fprintf(stderr, "grid shader unavailable, drawing cells as quads\n");
+    gpugrid = 0;
+  }
 }
 
 void draw_line(Line line, int position_y, int column) {
@@ -60,103 +92,264 @@ void draw_line(Line line, int position_y, int column) {
   }
 }
 
+/* the latest snapshot, the renderer reads only it and never term */
+static void take_view(void) {
+  view = snapshot_take();
+  drawing_context.winmode = view->winmode;
+}
+
 void drawregion(int position_x, int position_y, int column, int row) {
-  int i, line_number;
+  int i;
 
-  line_number = TLINEOFFSET(position_y);
+  take_view();
+  row = MIN(row, view->row);
+  column = MIN(column, view->col);
 
-  for (i = position_y; i < row; i++) {
+  for (i = position_y; i < row; i++)
+    draw_line(SNAPLINE(view, i), i, column);
 
-    draw_line(TSCREEN.buffer[line_number], i, column);
+  gl_flush();
+}
+
+static int view_selected(int x, int y) {
+  return inselection(&view->sel, view->alt, x, y);
+}
+
+/*
+ * The rows the cursor leaves and enters change as well, and so do the
+ * ones below them where an underline cursor is drawn.
+ */
+static bool cursor_row(int y) {
+  return y == old_cursor_y || y == old_cursor_y + 1 || y == view->cursor_y ||
+         y == view->cursor_y + 1;
+}
 
-    line_number = (line_number + 1) % TSCREEN.size;
+/*
+ * Draws the rows that changed since the back buffer was last on screen,
+ * age frames ago. An age of 0 means its content is unknown.
+ */
+static void draw_changed_rows(int age) {
+  bool full = false;
+  int y, end;
+  EGLint *rect;
+
+  if (gpugrid && grid_resize(view->col, view->row))
+    full = true;
+
+  if (row_changed_count != view->row) {
+    row_changed = xrealloc(row_changed, view->row * sizeof(*row_changed));
+    damage = xrealloc(damage, (view->row / 2 + 1) * 4 * sizeof(*damage));
+    grid_runs = xrealloc(grid_runs, (view->row / 2 + 1) * 2 * sizeof(*grid_runs));
+    row_changed_count = view->row;
+    full = true;
+  }
+
+  frame++;
+  grid_run_count = 0;
 
+  for (y = 0; y < view->row; y++) {
+    if (full || view->row_seq[y] > drawn_seq || cursor_row(y)) {
+      row_changed[y] = frame;
+      if (gpugrid)
+        grid_set_row(y, SNAPLINE(view, y));
+    }
+    if (frame - row_changed[y] < age || age == 0) {
+      stats.rows_rendered++;
+      if (!gpugrid)
+        draw_line(SNAPLINE(view, y), y, view->col);
+      else if (grid_run_count && grid_runs[2 * grid_run_count - 1] == y)
+        grid_runs[2 * grid_run_count - 1] = y + 1;
+      else {
+        grid_runs[2 * grid_run_count] = y;
+        grid_runs[2 * grid_run_count++ + 1] = y + 1;
+      }
+    }
+  }
+
+  if (!gpugrid)
+    gl_flush();
+
+  /* report runs of changed rows, EGL counts from the bottom */
+  damage_count = 0;
+  for (y = 0; y < view->row; y = end + 1) {
+    for (end = y; end < view->row && row_changed[end] == frame; end++)
+      ;
+    if (end == y)
+      continue;
+    rect = &damage[4 * damage_count++];
+    rect[0] = 0;
+    rect[1] = terminal_window.height - end * terminal_window.character_height;
+    rect[2] = terminal_window.width;
+    rect[3] = (end - y) * terminal_window.character_height;
   }
 }
 
-void draw(void) {
-  update_size();
+/* the glyph xdrawcursor() draws for a block cursor, in the colours of style */
+static PGlyph cursor_glyph(PGlyph g, int cursor_x, int cursor_y,
+                           Style *style) {
+  g.mode &= ATTR_BOLD | ATTR_ITALIC | ATTR_UNDERLINE | ATTR_STRUCK | ATTR_WIDE;
+
+  if (IS_DRAWSET(MODE_REVERSE)) {
+    g.mode |= ATTR_REVERSE;
+    style->bg = defaultfg;
+    if (view_selected(cursor_x, cursor_y))
+      style->fg = defaultrcs;
+    else
+      style->fg = defaultcs;
+  } else {
+    if (view_selected(cursor_x, cursor_y)) {
+      style->fg = defaultfg;
+      style->bg = defaultrcs;
+    } else {
+      style->fg = defaultbg;
+      style->bg = defaultcs;
+    }
+  }
+  return g;
+}
+
+static void glyph_colors(PGlyph glyph, Style style, int x, int y,
+                         RenderColor *color) {
+  if (view_selected(x, y))
+    glyph.mode ^= ATTR_REVERSE;
+  else if (glyph.mode & ATTR_REVERSE) {
+    glyph.mode ^= ATTR_REVERSE;
+  }
+
+  get_color(style, glyph.mode, color);
+}
+
+static void draw_glyph(PGlyph glyph, Style style, int x, int y);
+
+/* the rows to redraw in one pass, with the cursor xdrawcursor() would draw */
+static void draw_grid(int cursor_x, int cursor_y, PGlyph g) {
+  PColor cursor_color = {.r = 1, .g = 1, .b = 1};
+  Style style;
+  int shape = GRID_CURSOR_NONE;
+  RenderColor color;
 
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  if (!IS_DRAWSET(MODE_HIDE) && IS_DRAWSET(MODE_FOCUSED)) {
+    switch (view->cursor) {
+    case 0: /* Blinking Block */
+    case 1: /* Blinking Block (Default) */
+    case 2: /* Steady Block */
+      shape = GRID_CURSOR_BLOCK;
+      break;
+    case 3: /* Blinking Underline */
+    case 4: /* Steady Underline */
+      shape = GRID_CURSOR_UNDERLINE;
+      break;
+    case 5: /* Blinking bar */
+    case 6: /* Steady bar */
+      shape = GRID_CURSOR_BAR;
+      break;
+    }
+  }
 
-  int cursor_x = term.cursor.x;
-  int old_cursor_x = term.old_cursor_x;
-  int old_cursor_y = term.old_cursor_y;
+  if (shape == GRID_CURSOR_BLOCK) {
+    g = cursor_glyph(g, cursor_x, cursor_y, &style);
+    glyph_colors(g, style, cursor_x, cursor_y, &color);
+    grid_draw(grid_runs, grid_run_count, cursor_x, cursor_y, shape,
+              color.gl_foreground_color, color.gl_background_color,
+              &view->sel, view->alt);
+  } else {
+    grid_draw(grid_runs, grid_run_count, cursor_x, cursor_y, shape,
+              cursor_color, cursor_color, &view->sel, view->alt);
+  }
+}
 
-  if(!IS_WINDOSET(MODE_VISIBLE))
+/*
+ * Draws what changed since the back buffer was last shown, from the
+ * latest snapshot the parser published.
+ */
+void draw_terminal(void) {
+  int cursor_x, cursor_y;
+  int age;
+
+  take_view();
+  if (!view->row)
     return;
+  cursor_x = view->cursor_x;
+  cursor_y = view->cursor_y;
+
+  age = gl_buffer_age();
+  if (age == 0)
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 
   /* adjust cursor position */
-  LIMIT(term.old_cursor_x, 0, term.col - 1);
-  LIMIT(term.old_cursor_y, 0, term.row - 1);
+  LIMIT(old_cursor_x, 0, view->col - 1);
+  LIMIT(old_cursor_y, 0, view->row - 1);
 
-  if (TLINE(term.old_cursor_y)[term.old_cursor_x].mode & ATTR_WDUMMY)
-    term.old_cursor_x--;
+  if (SNAPLINE(view, old_cursor_y)[old_cursor_x].mode & ATTR_WDUMMY)
+    old_cursor_x--;
 
-  if (TLINE(term.cursor.y)[cursor_x].mode & ATTR_WDUMMY)
+  if (SNAPLINE(view, cursor_y)[cursor_x].mode & ATTR_WDUMMY)
     cursor_x--;
 
-  drawregion(0, 0, term.col, term.row);
+  draw_changed_rows(age);
 
-  xdrawcursor(cursor_x, term.cursor.y, TLINE(term.cursor.y)[cursor_x],
-               term.old_cursor_x, term.old_cursor_y,
-               TLINE(term.old_cursor_y)[term.old_cursor_x]);
+  if (gpugrid)
+    draw_grid(cursor_x, cursor_y, SNAPLINE(view, cursor_y)[cursor_x]);
+  else
+    xdrawcursor(cursor_x, cursor_y, SNAPLINE(view, cursor_y)[cursor_x],
+                old_cursor_x, old_cursor_y,
+                SNAPLINE(view, old_cursor_y)[old_cursor_x]);
 
-  term.old_cursor_x = cursor_x;
-  term.old_cursor_y = term.cursor.y;
+  old_cursor_x = cursor_x;
+  old_cursor_y = cursor_y;
+  drawn_seq = view->seq;
+}
 
+void draw(void) {
+  uint64_t start, swap;
+
+  update_size();
+
+  take_view();
+  if(!IS_DRAWSET(MODE_VISIBLE)) {
+    stats.frames_skipped++;
+    return;
+  }
+
+  start = stats_now();
+  draw_terminal();
+  swap = stats_now();
   swap_draw_buffers();
+  stats_add(&stats.swap, swap);
+  stats_add(&stats.frame, start);
+  stats.frames++;
 }
 
 
 
 void xdrawcursor(int cursor_x, int cursor_y, PGlyph g, int old_x, int old_y,
                  PGlyph og) {
-  Color drawcol;
+  Style style;
 
   /* remove the old cursor */
-  if (selected(old_x, old_y))
+  if (view_selected(old_x, old_y))
     og.mode ^= ATTR_REVERSE;
   xdrawglyph(og, old_x, old_y);
+  gl_flush();
 
-  if (IS_WINDOSET(MODE_HIDE))
+  if (IS_DRAWSET(MODE_HIDE))
     return;
 
   /*
    * Select the right color for the right mode.
    */
-  g.mode &= ATTR_BOLD | ATTR_ITALIC | ATTR_UNDERLINE | ATTR_STRUCK | ATTR_WIDE;
+  g = cursor_glyph(g, cursor_x, cursor_y, &style);
 
-  if (IS_WINDOSET(MODE_REVERSE)) {
-    g.mode |= ATTR_REVERSE;
-    g.bg = defaultfg;
-    if (selected(cursor_x, cursor_y)) {
-      drawcol = drawing_context.colors[defaultcs];
-      g.fg = defaultrcs;
-    } else {
-      drawcol = drawing_context.colors[defaultrcs];
-      g.fg = defaultcs;
-    }
-  } else {
-    if (selected(cursor_x, cursor_y)) {
-      g.fg = defaultfg;
-      g.bg = defaultrcs;
-    } else {
-      g.fg = defaultbg;
-      g.bg = defaultcs;
-    }
-    drawcol = drawing_context.colors[g.bg];
-  }
   int winx, winy;
   PColor cursor_color = {.r = 1, .g = 1, .b = 1};
   /* draw the new one */
-  if (IS_WINDOSET(MODE_FOCUSED)) {
-    switch (terminal_window.cursor) {
+  if (IS_DRAWSET(MODE_FOCUSED)) {
+    switch (view->cursor) {
     case 0:         /* Blinking Block */
     case 1:         /* Blinking Block (Default) */
     case 2:         /* Steady Block */
-      xdrawglyph(g, cursor_x, cursor_y);
+      draw_glyph(g, style, cursor_x, cursor_y);
       break;
     case 3: /* Blinking Underline */
     case 4: /* Steady Underline */
@@ -185,18 +378,18 @@ void xdrawcursor(int cursor_x, int cursor_y, PGlyph g, int old_x, int old_y,
     // XftDrawRect(xw.draw, &drawcol, borderpx + cx * win.cw,
     //             borderpx + (cy + 1) * win.ch - 1, win.cw, 1);
   }
+
+  gl_flush();
 }
 
 void xdrawglyph(PGlyph glyph, int x, int y) {
+  draw_glyph(glyph, GLYPHSTYLE(glyph), x, y);
+}
 
-  if (selected(x, y))
-    glyph.mode ^= ATTR_REVERSE;
-  else if (glyph.mode & ATTR_REVERSE) {
-    glyph.mode ^= ATTR_REVERSE;
-  }
+static void draw_glyph(PGlyph glyph, Style style, int x, int y) {
 
   RenderColor color;
-  get_color_from_glyph(&glyph, &color);
+  glyph_colors(glyph, style, x, y, &color);
 
   int winy = y * terminal_window.character_height;
   int background_x = x * terminal_window.character_width;
@@ -230,7 +423,9 @@ void xdrawglyph(PGlyph glyph, int x, int y) {
 
   gl_draw_char(ascii_value, color.gl_foreground_color, draw_x, draw_y,
                terminal_window.character_gl_width,
-               terminal_window.character_gl_height);
+               terminal_window.character_gl_height, background_x, winy,
+               terminal_window.character_width,
+               terminal_window.character_height);
 }
 
 
@@ -8,8 +8,12 @@
 typedef struct {
   Color *colors;
   size_t colors_count;
+  int winmode; /* of the snapshot being drawn */
 } DC;
 
+/* the window modes the frame is drawn with, not terminal_window's */
+#define IS_DRAWSET(flag) ((drawing_context.winmode & (flag)) != 0)
+
 extern DC drawing_context;
 
 extern int borderpx;
@@ -18,7 +22,10 @@ extern unsigned int defaultrcs;
 
 extern bool can_update_size;
 
+extern int gpugrid;
+
 void draw(void);
+void draw_terminal(void);
 
 void drawregion(int, int, int, int);
 
@@ -0,0 +1,279 @@
+#define GL_GLEXT_PROTOTYPES
+#include "gridshader.h"
+
+#include <GL/gl.h>
+#include <GL/glext.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "draw.h"
+#include "opengl.h"
+#include "selection.h"
+#include "utf8.h"
+#include "window.h"
+
+/*
+ * Each cell takes GRID_TEXELS texels in a row of the grid texture: the
+ * atlas index in red, then foreground and background, then the same two
+ * colours as drawn while the cell is selected.
+ */
+#define GRID_TEXELS 5
+
+/* GRID_TEXELS as a GLSL float literal */
+#define GLSL_FLOAT(n) #n ".0"
+#define GLSL_TEXELS(n) GLSL_FLOAT(n)
+
+static const char *vertex_source =
+  "#version 120\n"
+  "varying vec2 position;\n"
+  "void main() {\n"
+  "  position = gl_Vertex.xy;\n"
+  "  gl_Position = ftransform();\n"
+  "}\n";
+
+static const char *fragment_source =
+  "#version 120\n"
+  "uniform sampler2D grid;\n"
+  "uniform sampler2D font;\n"
+  "uniform vec2 grid_size;\n"
+  "uniform vec2 cell_size;\n"
+  "uniform vec2 glyph_size;\n"
+  "uniform vec4 selection;\n" /* begin x, y, end x, y; x < 0 when none */
+  "uniform bool selection_rectangular;\n"
+  "uniform vec3 cursor;\n" /* x, y, shape */
+  "uniform vec3 cursor_fg;\n"
+  "uniform vec3 cursor_bg;\n"
+  "uniform float cursor_thickness;\n"
+  "varying vec2 position;\n"
+  "\n"
+  "bool selected(vec2 cell) {\n"
+  "  if (selection.x < 0.0 || cell.y < selection.y || cell.y > selection.w)\n"
+  "    return false;\n"
+  "  if (selection_rectangular)\n"
+  "    return cell.x >= selection.x && cell.x <= selection.z;\n"
+  "  return (cell.y != selection.y || cell.x >= selection.x) &&\n"
+  "         (cell.y != selection.w || cell.x <= selection.z);\n"
+  "}\n"
+  "\n"
+  "vec4 texel(vec2 cell, float i) {\n"
+  "  float texels = " GLSL_TEXELS(GRID_TEXELS) ";\n"
+  "  return texture2D(grid, vec2((cell.x * texels + i + 0.5) /\n"
+  "                              (grid_size.x * texels),\n"
+  "                              (cell.y + 0.5) / grid_size.y));\n"
+  "}\n"
+  "\n"
+  "void main() {\n"
+  "  vec2 cell = floor(position / cell_size);\n"
+  "  vec2 inside = position - cell * cell_size;\n"
+  "  float i = selected(cell) ? 3.0 : 1.0;\n"
+  "  vec3 fg = texel(cell, i).rgb;\n"
+  "  vec3 bg = texel(cell, i + 1.0).rgb;\n"
+  "  float index = floor(texel(cell, 0.0).r * 255.0 + 0.5);\n"
+  "  vec2 uv = (inside - (cell_size - glyph_size) / 2.0 - vec2(0.0, 1.0)) /\n"
+  "            glyph_size;\n"
+  "  vec4 ink = vec4(0.0);\n"
+  "\n"
+  "  if (cell == cursor.xy && cursor.z == 1.0) {\n"
+  "    fg = cursor_fg;\n"
+  "    bg = cursor_bg;\n"
+  "  }\n"
+  "  if (all(greaterThanEqual(uv, vec2(0.0))) && all(lessThan(uv, vec2(1.0))))\n"
+  "    ink = texture2D(font, (vec2(mod(index, 16.0), floor(index / 16.0)) + uv) /\n"
+  "                          16.0);\n"
+  "  gl_FragColor = vec4(mix(bg, fg * ink.rgb, ink.a), 1.0);\n"
+  "\n"
+  "  /* underline below and bar left of the cursor cell */\n"
+  "  inside = position - cursor.xy * cell_size;\n"
+  "  if ((cursor.z == 2.0 && inside.x >= 0.0 && inside.x < cell_size.x &&\n"
+  "       inside.y >= cell_size.y && inside.y < cell_size.y + cursor_thickness) ||\n"
+  "      (cursor.z == 3.0 && inside.x >= 0.0 && inside.x < cursor_thickness &&\n"
+  "       inside.y >= 0.0 && inside.y < cell_size.y))\n"
+  "    gl_FragColor = vec4(cursor_bg, 1.0);\n"
+  "}\n";
+
+static GLuint program;
+static GLint grid_size_uniform, cell_size_uniform, glyph_size_uniform;
+static GLint selection_uniform, selection_rectangular_uniform;
+static GLint cursor_uniform, cursor_fg_uniform, cursor_bg_uniform;
+static GLint cursor_thickness_uniform;
+static GLuint grid_texture;
+static int grid_cols, grid_rows;
+static uint8_t *grid_row;
+static GLfloat *quads;
+
+static GLuint compile_shader(GLenum type, const char *source) {
+  GLuint shader = glCreateShader(type);
+  char log[512];
+  GLint ok;
+
+  glShaderSource(shader, 1, &source, NULL);
+  glCompileShader(shader);
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+  if (!ok) {
+    glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+    fprintf(stderr, "grid shader: %s\n", log);
+    glDeleteShader(shader);
+    return 0;
+  }
+  return shader;
+}
+
+/* false when the driver cannot run the shader, draw cells as quads then */
+bool grid_init(void) {
+  GLuint vertex, fragment;
+  char log[512];
+  GLint ok;
+
+  vertex = compile_shader(GL_VERTEX_SHADER, vertex_source);
+  fragment = compile_shader(GL_FRAGMENT_SHADER, fragment_source);
+  if (!vertex || !fragment)
+    return false;
+
+  program = glCreateProgram();
+  glAttachShader(program, vertex);
+  glAttachShader(program, fragment);
+  glLinkProgram(program);
+  glDeleteShader(vertex);
+  glDeleteShader(fragment);
+  glGetProgramiv(program, GL_LINK_STATUS, &ok);
+  if (!ok) {
+    glGetProgramInfoLog(program, sizeof(log), NULL, log);
+    fprintf(stderr, "grid shader: %s\n", log);
+    glDeleteProgram(program);
+    program = 0;
+    return false;
+  }
+
+  /* the textures stay on the same units, the rest is set every frame */
+  glUseProgram(program);
+  glUniform1i(glGetUniformLocation(program, "grid"), 0);
+  glUniform1i(glGetUniformLocation(program, "font"), 1);
+  glUseProgram(0);
+  grid_size_uniform = glGetUniformLocation(program, "grid_size");
+  cell_size_uniform = glGetUniformLocation(program, "cell_size");
+  glyph_size_uniform = glGetUniformLocation(program, "glyph_size");
+  selection_uniform = glGetUniformLocation(program, "selection");
+  selection_rectangular_uniform =
+      glGetUniformLocation(program, "selection_rectangular");
+  cursor_uniform = glGetUniformLocation(program, "cursor");
+  cursor_fg_uniform = glGetUniformLocation(program, "cursor_fg");
+  cursor_bg_uniform = glGetUniformLocation(program, "cursor_bg");
+  cursor_thickness_uniform = glGetUniformLocation(program, "cursor_thickness");
+
+  glGenTextures(1, &grid_texture);
+  glBindTexture(GL_TEXTURE_2D, grid_texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  return true;
+}
+
+/* true when the grid texture was reallocated and every row must be set */
+bool grid_resize(int cols, int rows) {
+  if (cols == grid_cols && rows == grid_rows)
+    return false;
+
+  grid_cols = cols;
+  grid_rows = rows;
+  grid_row = xrealloc(grid_row, cols * GRID_TEXELS * 4);
+  quads = xrealloc(quads, (rows / 2 + 1) * 8 * sizeof(*quads));
+
+  glBindTexture(GL_TEXTURE_2D, grid_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cols * GRID_TEXELS, rows, 0,
+               GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  return true;
+}
+
+static void put_color(uint8_t *texel, PColor color) {
+  texel[0] = MIN(MAX(color.r, 0), 1) * 255 + 0.5f;
+  texel[1] = MIN(MAX(color.g, 0), 1) * 255 + 0.5f;
+  texel[2] = MIN(MAX(color.b, 0), 1) * 255 + 0.5f;
+  texel[3] = 255;
+}
+
+/* resolves the colours of row y on the CPU, the shader only picks */
+void grid_set_row(int y, Line line) {
+  uint8_t *texel = grid_row;
+  RenderColor color;
+  PGlyph glyph;
+  int x;
+
+  if (!line)
+    return;
+
+  for (x = 0; x < grid_cols; x++, texel += GRID_TEXELS * 4) {
+    glyph = line[x];
+    texel[0] = glyph.u > 127 ? get_texture_atlas_index(glyph.u) : glyph.u;
+    texel[1] = texel[2] = texel[3] = 0;
+
+    /* as xdrawglyph(): reverse video only shows up in a selection */
+    glyph.mode &= ~ATTR_REVERSE;
+    get_color_from_glyph(&glyph, &color);
+    put_color(texel + 4, color.gl_foreground_color);
+    put_color(texel + 8, color.gl_background_color);
+
+    glyph.mode = line[x].mode ^ ATTR_REVERSE;
+    get_color_from_glyph(&glyph, &color);
+    put_color(texel + 12, color.gl_foreground_color);
+    put_color(texel + 16, color.gl_background_color);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, grid_texture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, grid_cols * GRID_TEXELS, 1, GL_RGBA,
+                  GL_UNSIGNED_BYTE, grid_row);
+}
+
+/*
+ * One pass over the runs of rows from first to end, given as pairs in
+ * runs. Selection and cursor are applied in the shader, alt tells whether
+ * the alternate screen is shown.
+ */
+void grid_draw(const int *runs, int run_count, int cursor_x, int cursor_y,
+               int cursor_shape, PColor cursor_fg, PColor cursor_bg,
+               const Selection *sel, int alt) {
+  GLfloat width = grid_cols * terminal_window.character_width;
+  GLfloat top, bottom, *quad;
+  int i;
+  bool visible = sel->mode != SEL_EMPTY &&
+                 sel->original_beginning.x != -1 && sel->alt == alt;
+
+  glUseProgram(program);
+
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, font_texture_id);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, grid_texture);
+
+  glUniform2f(grid_size_uniform, grid_cols, grid_rows);
+  glUniform2f(cell_size_uniform, terminal_window.character_width,
+              terminal_window.character_height);
+  glUniform2f(glyph_size_uniform, terminal_window.character_gl_width,
+              terminal_window.character_gl_height);
+  glUniform4f(selection_uniform, visible ? sel->beginning_normalized.x : -1,
+              sel->beginning_normalized.y, sel->end_normalized.x,
+              sel->end_normalized.y);
+  glUniform1i(selection_rectangular_uniform, sel->type == SEL_RECTANGULAR);
+  glUniform3f(cursor_uniform, cursor_x, cursor_y, cursor_shape);
+  glUniform3f(cursor_fg_uniform, cursor_fg.r, cursor_fg.g, cursor_fg.b);
+  glUniform3f(cursor_bg_uniform, cursor_bg.r, cursor_bg.g, cursor_bg.b);
+  glUniform1f(cursor_thickness_uniform, cursorthickness);
+
+  for (i = 0, quad = quads; i < run_count; i++, quad += 8) {
+    top = runs[2 * i] * terminal_window.character_height;
+    bottom = runs[2 * i + 1] * terminal_window.character_height;
+    quad[0] = 0;     quad[1] = top;
+    quad[2] = width; quad[3] = top;
+    quad[4] = width; quad[5] = bottom;
+    quad[6] = 0;     quad[7] = bottom;
+  }
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glVertexPointer(2, GL_FLOAT, 0, quads);
+  glDrawArrays(GL_QUADS, 0, 4 * run_count);
+  glDisableClientState(GL_VERTEX_ARRAY);
+
+  glUseProgram(0);
+}
@@ -0,0 +1,25 @@
+#ifndef GRIDSHADER_H
+#define GRIDSHADER_H
+
+#include <stdbool.h>
+#include "color.h"
+#include "terminal.h"
+#include "selection.h"
+
+/* cursor shapes for grid_draw() */
+enum grid_cursor {
+  GRID_CURSOR_NONE,
+  GRID_CURSOR_BLOCK,
+  GRID_CURSOR_UNDERLINE,
+  GRID_CURSOR_BAR,
+};
+
+bool grid_init(void);
+bool grid_resize(int cols, int rows);
+void grid_set_row(int y, Line line);
+
+void grid_draw(const int *runs, int run_count, int cursor_x, int cursor_y,
+               int cursor_shape, PColor cursor_fg, PColor cursor_bg,
+               const Selection *sel, int alt);
+
+#endif
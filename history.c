@@ -0,0 +1,552 @@
+#include "history.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lines.h"
+#include "utf8.h"
+
+/*
+ * Scrollback older than the line ring of the primary screen. A line that
+ * falls off the ring is queued as it is, and a thread of its own packs the
+ * queue HIST_BLOCK lines at a time: per line the runes as UTF-8 and the
+ * attributes as spans of mode, fg and bg, trailing blanks left out, the
+ * whole block then squeezed by a small LZ77. Colours are stored as values,
+ * not style ids, so packed lines do not hold on to term.styles. Reading a
+ * line unpacks its block and copies the line into a cache as wide as the
+ * terminal. Past histlines, or histmem MB of packed blocks, the oldest
+ * blocks are dropped.
+ *
+ * Lines are numbered in the order they were pushed. The packed ones come
+ * first, the queued ones follow, and the parser thread is the only one to
+ * push, drop, clear or read, all under the term lock.
+ */
+#define HIST_QUEUED (4 * HIST_BLOCK) /* queued lines push() waits at */
+#define HIST_UNPACKED 2              /* unpacked blocks kept for reading */
+#define HIST_THAWMIN 64
+
+#define LZ_HASH 12
+#define LZ_MIN 4
+#define LZ_WINDOW 0xFFFF
+
+typedef struct {
+  uint8_t *data;
+  uint32_t size;    /* packed */
+  uint32_t rawsize; /* before the LZ pass */
+} Block;
+
+typedef struct {
+  uint64_t first; /* number of the first line, UINT64_MAX when unused */
+  uint8_t *data;
+  size_t size;
+  uint32_t off[HIST_BLOCK]; /* where each line starts in data */
+} Unpacked;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER; /* a block is queued */
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER; /* a block is packed */
+static pthread_t thread;
+static int started, packing;
+
+/* packed blocks, oldest first, a ring of bsize from blocks[bhead] */
+static Block *blocks;
+static int bhead, bcount, bsize;
+#define BLOCK(i) (blocks[(bhead + (i)) & (bsize - 1)])
+static size_t bbytes;
+
+/* queued lines, oldest first, a ring of qsize from queue[qhead] */
+static Line *queue;
+static int qhead, qcount, qsize;
+
+/*
+ * Packed lines, handed back by history_push() to be reused, so lines are
+ * only ever freed under the term lock. A push takes one whenever there
+ * are any, so the queue and these never hold more than qsize together.
+ */
+static Line *spare;
+static int nspare;
+
+/* numbers of the oldest line kept and of the next line pushed */
+static uint64_t first, pushed;
+
+/* unpacked lines, by number modulo thawsize */
+static Line *thaw;
+static uint64_t *thawnum;
+static int thawsize, thawwidth;
+static Unpacked unpacked[HIST_UNPACKED] = {{UINT64_MAX}, {UINT64_MAX}};
+static int unpacknext;
+
+static uint8_t *putvar(uint8_t *p, uint32_t v) {
+  for (; v >= 0x80; v >>= 7)
+    *p++ = v | 0x80;
+  *p++ = v;
+  return p;
+}
+
+static uint32_t getvar(const uint8_t **p) {
+  uint32_t v = 0;
+  int shift = 0;
+  uint8_t b;
+
+  do {
+    b = *(*p)++;
+    v |= (uint32_t)(b & 0x7F) << shift;
+    shift += 7;
+  } while (b & 0x80);
+  return v;
+}
+
+static uint32_t lzhash(const uint8_t *p) {
+  uint32_t v;
+
+  memcpy(&v, p, 4);
+  return v * 0x9E3779B1u >> (32 - LZ_HASH);
+}
+
+static uint8_t *lzcount(uint8_t *op, size_t n) {
+  for (; n >= 255; n -= 255)
+    *op++ = 255;
+  *op++ = n;
+  return op;
+}
+
+/* literals, then a match of len at off back unless len is 0 */
+static uint8_t *lzseq(uint8_t *op, const uint8_t *lit, size_t nlit,
+                      size_t off, size_t len) {
+  uint8_t *token = op++;
+
+  *token = MIN(nlit, 15) << 4;
+  if (nlit >= 15)
+    op = lzcount(op, nlit - 15);
+  memcpy(op, lit, nlit);
+  op += nlit;
+  if (len) {
+    *token |= MIN(len - LZ_MIN, 15);
+    *op++ = off;
+    *op++ = off >> 8;
+    if (len - LZ_MIN >= 15)
+      op = lzcount(op, len - LZ_MIN - 15);
+  }
+  return op;
+}
+
+/*
+ * LZ4 style: a token of literal and match length, the literals, a 16 bit
+ * offset. The last sequence has literals only. out needs room for
+ * n + n / 255 + 16 bytes.
+ */
+static size_t lzpack(const uint8_t *in, size_t n, uint8_t *out) {
+  uint32_t table[1 << LZ_HASH] = {0}; /* position + 1 */
+  const uint8_t *ip = in, *anchor = in, *end = in + n, *ref;
+  uint8_t *op = out;
+  uint32_t h, pos, misses = 0;
+  size_t len;
+
+  while (end - ip >= LZ_MIN) {
+    h = lzhash(ip);
+    pos = table[h];
+    table[h] = ip - in + 1;
+    if (!pos || ip - (ref = in + pos - 1) > LZ_WINDOW ||
+        memcmp(ref, ip, LZ_MIN)) {
+      /* skip faster through what does not compress */
+      ip += 1 + (misses++ >> 5);
+      continue;
+    }
+    misses = 0;
+    for (len = LZ_MIN; ip + len < end && ref[len] == ip[len]; len++)
+      ;
+    op = lzseq(op, anchor, ip - anchor, ip - ref, len);
+    ip += len;
+    anchor = ip;
+  }
+  op = lzseq(op, anchor, end - anchor, 0, 0);
+  return op - out;
+}
+
+static size_t lzlength(const uint8_t **ip, const uint8_t *end, size_t n) {
+  uint8_t b;
+
+  if (n != 15)
+    return n;
+  do {
+    if (*ip >= end)
+      die("history: corrupt block\n");
+    n += b = *(*ip)++;
+  } while (b == 255);
+  return n;
+}
+
+static void lzunpack(const uint8_t *in, size_t size, uint8_t *out, size_t n) {
+  const uint8_t *ip = in, *end = in + size;
+  uint8_t *op = out, *oend = out + n;
+  size_t lit, len, off;
+  uint8_t token;
+
+  while (ip < end) {
+    token = *ip++;
+    lit = lzlength(&ip, end, token >> 4);
+    if (lit > (size_t)(end - ip) || lit > (size_t)(oend - op))
+      die("history: corrupt block\n");
+    memcpy(op, ip, lit);
+    op += lit;
+    ip += lit;
+    if (ip == end)
+      break;
+    if (end - ip < 2)
+      die("history: corrupt block\n");
+    off = ip[0] | ip[1] << 8;
+    ip += 2;
+    len = lzlength(&ip, end, token & 15) + LZ_MIN;
+    if (!off || off > (size_t)(op - out) || len > (size_t)(oend - op))
+      die("history: corrupt block\n");
+    for (; len > 0; len--, op++)
+      *op = op[-off];
+  }
+  if (op != oend)
+    die("history: corrupt block\n");
+}
+
+/*
+ * A line is its length in cells without the trailing default blanks, the
+ * bytes of its runes, the runes and then spans of length, mode, fg and bg
+ * until the length is covered.
+ */
+static uint8_t *packline(uint8_t *p, Line line, int width) {
+  uint8_t *runes;
+  Style s;
+  int x, n;
+
+  while (width > 0 && line[width - 1].u == ' ' && !line[width - 1].mode &&
+         line[width - 1].style == STYLE_DEFAULT)
+    width--;
+
+  runes = p + 10;
+  for (x = 0; x < width; x++) {
+    if (line[x].u < 0x80)
+      *runes++ = line[x].u;
+    else
+      runes += utf8encode(line[x].u, (char *)runes);
+  }
+  n = runes - (p + 10);
+  p = putvar(putvar(p, width), n);
+  memmove(p, runes - n, n);
+  p += n;
+
+  for (x = 0; x < width; x += n) {
+    for (n = 1; x + n < width && !ATTRCMP(line[x], line[x + n]); n++)
+      ;
+    s = term.styles[line[x].style];
+    p = putvar(putvar(putvar(putvar(p, n), line[x].mode), s.fg), s.bg);
+  }
+  return p;
+}
+
+static Block pack(Line *lines, int n) {
+  static uint8_t *raw, *out;
+  static size_t rawsize;
+  uint8_t *p;
+  size_t need = 0;
+  Block b;
+  int i;
+
+  for (i = 0; i < n; i++)
+    need += 10 + LINEWIDTH(lines[i]) * (UTF_SIZ + 20);
+  if (need > rawsize) {
+    rawsize = need;
+    raw = xrealloc(raw, rawsize);
+    out = xrealloc(out, rawsize + rawsize / 255 + 16);
+  }
+
+  for (p = raw, i = 0; i < n; i++)
+    p = packline(p, lines[i], LINEWIDTH(lines[i]));
+  b.rawsize = p - raw;
+  b.size = lzpack(raw, b.rawsize, out);
+  b.data = xmalloc(b.size);
+  memcpy(b.data, out, b.size);
+  return b;
+}
+
+static void blockgrow(void) {
+  Block *old = blocks;
+  int i, size = bsize;
+
+  bsize = MAX(bsize * 2, 64);
+  blocks = xmalloc(bsize * sizeof(*blocks));
+  for (i = 0; i < bcount; i++)
+    blocks[i] = old[(bhead + i) & (size - 1)];
+  bhead = 0;
+  free(old);
+}
+
+static void *packer(void *arg) {
+  Line lines[HIST_BLOCK];
+  sigset_t all;
+  Block b;
+  int i;
+
+  /* signals are for the main thread */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    while (qcount < HIST_BLOCK)
+      pthread_cond_wait(&work, &lock);
+    for (i = 0; i < HIST_BLOCK; i++)
+      lines[i] = queue[(qhead + i) & (qsize - 1)];
+    packing = 1;
+    pthread_mutex_unlock(&lock);
+
+    b = pack(lines, HIST_BLOCK);
+
+    pthread_mutex_lock(&lock);
+    if (bcount == bsize)
+      blockgrow();
+    BLOCK(bcount++) = b;
+    bbytes += b.size;
+    qhead = (qhead + HIST_BLOCK) & (qsize - 1);
+    qcount -= HIST_BLOCK;
+    packing = 0;
+    pthread_cond_broadcast(&done);
+    /* never more than the queue holds, see history_push() */
+    for (i = 0; i < HIST_BLOCK; i++)
+      spare[nspare++] = lines[i];
+  }
+  return NULL;
+}
+
+/*
+ * Takes over line as the newest line of the history. Returns a packed
+ * line to reuse, of whatever width it had, or NULL.
+ */
+Line history_push(Line line) {
+  Line reuse = NULL;
+  uint64_t keep;
+
+  pthread_mutex_lock(&lock);
+  if (!started) {
+    qsize = HIST_QUEUED;
+    queue = xmalloc(qsize * sizeof(*queue));
+    spare = xmalloc(HIST_QUEUED * sizeof(*spare));
+    if (pthread_create(&thread, NULL, packer, NULL) != 0)
+      die("couldn't start the history thread\n");
+    pthread_detach(thread);
+    started = 1;
+  }
+  while (qcount == qsize)
+    pthread_cond_wait(&done, &lock);
+
+  queue[(qhead + qcount++) & (qsize - 1)] = line;
+  pushed++;
+  if (qcount % HIST_BLOCK == 0)
+    pthread_cond_signal(&work);
+  if (nspare > 0)
+    reuse = spare[--nspare];
+
+  /* histlines counts the lines still in the ring as well */
+  keep = histlines -
+         MIN(histlines, (unsigned int)(term.screen[0].size - term.row));
+  while (bcount > 0 && (bbytes > (size_t)histmem << 20 ||
+                        pushed - first - HIST_BLOCK >= keep)) {
+    bbytes -= BLOCK(0).size;
+    free(BLOCK(0).data);
+    bhead = (bhead + 1) & (bsize - 1);
+    bcount--;
+    first += HIST_BLOCK;
+  }
+  pthread_mutex_unlock(&lock);
+  return reuse;
+}
+
+static Unpacked *unpack(uint64_t num, Block b) {
+  Unpacked *u;
+  const uint8_t *p;
+  uint32_t width, runes, len;
+  int i;
+
+  for (i = 0; i < HIST_UNPACKED; i++) {
+    if (unpacked[i].first == num)
+      return &unpacked[i];
+  }
+
+  u = &unpacked[unpacknext];
+  unpacknext = (unpacknext + 1) % HIST_UNPACKED;
+  if (u->size < b.rawsize) {
+    u->size = b.rawsize;
+    u->data = xrealloc(u->data, u->size);
+  }
+  lzunpack(b.data, b.size, u->data, b.rawsize);
+  u->first = num;
+
+  for (p = u->data, i = 0; i < HIST_BLOCK; i++) {
+    u->off[i] = p - u->data;
+    width = getvar(&p);
+    runes = getvar(&p);
+    for (p += runes; width > 0; width -= len) {
+      len = getvar(&p);
+      getvar(&p);
+      getvar(&p);
+      getvar(&p);
+    }
+  }
+  return u;
+}
+
+static void unpackline(const uint8_t *p, Line line, int width) {
+  static Rune *u;
+  static int usize;
+  const uint8_t *spans;
+  uint32_t n, end, mode, fg, bg, style;
+  size_t runes, count;
+  uint32_t x;
+
+  if (usize < width) {
+    usize = width;
+    u = xrealloc(u, usize * sizeof(*u));
+  }
+  n = getvar(&p);
+  runes = getvar(&p);
+  spans = p + runes;
+  count = MIN(n, (uint32_t)width);
+  utf8decodebuf((const char *)p, runes, u, &count);
+
+  for (x = 0; x < n; x = end) {
+    end = x + getvar(&spans);
+    mode = getvar(&spans);
+    fg = getvar(&spans);
+    bg = getvar(&spans);
+    style = tstyle(fg, bg);
+    for (; x < end && x < count; x++)
+      line[x] = (PGlyph){.u = u[x], .mode = mode, .style = style};
+  }
+  for (x = count; x < (uint32_t)width; x++)
+    line[x] = (PGlyph){.u = ' ', .style = STYLE_DEFAULT};
+}
+
+static void thawresize(void) {
+  int i, size = HIST_THAWMIN;
+
+  while (size < 4 * term.row)
+    size *= 2;
+  for (i = 0; i < thawsize; i++)
+    linefree(thaw[i]);
+  thawsize = size;
+  thawwidth = term.linelen;
+  thaw = xrealloc(thaw, thawsize * sizeof(*thaw));
+  thawnum = xrealloc(thawnum, thawsize * sizeof(*thawnum));
+  for (i = 0; i < thawsize; i++) {
+    thaw[i] = NULL;
+    thawnum[i] = UINT64_MAX;
+  }
+}
+
+/*
+ * The i-th newest line, as wide as the terminal, or NULL. It stays valid
+ * until thawsize other lines are read.
+ */
+Line history_line(int i) {
+  uint64_t num = pushed - 1 - i;
+  Unpacked *u;
+  Line q;
+  Block b;
+  Line line;
+  int64_t n;
+  int slot;
+
+  if (i < 0 || i >= history_count())
+    return NULL;
+  if (thawwidth != term.linelen || thawsize < 4 * term.row)
+    thawresize();
+  slot = num & (thawsize - 1);
+  if (thawnum[slot] == num)
+    return thaw[slot];
+  if (!thaw[slot])
+    thaw[slot] = linealloc(thawwidth);
+  line = thaw[slot];
+  thawnum[slot] = UINT64_MAX;
+
+  pthread_mutex_lock(&lock);
+  n = (int64_t)(num - first) - (int64_t)bcount * HIST_BLOCK;
+  if (n >= 0) {
+    q = queue[(qhead + n) & (qsize - 1)];
+    n = MIN(LINEWIDTH(q), thawwidth);
+    memcpy(line, q, n * sizeof(PGlyph));
+    pthread_mutex_unlock(&lock);
+    for (; n < thawwidth; n++)
+      line[n] = (PGlyph){.u = ' ', .style = STYLE_DEFAULT};
+  } else {
+    n = (num - first) / HIST_BLOCK;
+    b = BLOCK(n);
+    pthread_mutex_unlock(&lock);
+    /* packed blocks only go away in history_push() */
+    u = unpack(first + n * HIST_BLOCK, b);
+    unpackline(u->data + u->off[num - u->first], line, thawwidth);
+  }
+  thawnum[slot] = num;
+  return line;
+}
+
+int history_count(void) { return pushed - first; }
+
+/* marks the styles of the queued and unpacked lines, see stylecollect() */
+void history_mark(uint8_t *live, uint32_t count) {
+  Line q;
+  int i, x;
+
+  pthread_mutex_lock(&lock);
+  for (i = 0; i < qcount; i++) {
+    q = queue[(qhead + i) & (qsize - 1)];
+    for (x = 0; x < LINEWIDTH(q); x++) {
+      if (q[x].style < count)
+        live[q[x].style] = 1;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+
+  for (i = 0; i < thawsize; i++) {
+    for (x = 0; thaw[i] && x < thawwidth; x++) {
+      if (thaw[i][x].style < count)
+        live[thaw[i][x].style] = 1;
+    }
+  }
+}
+
+void history_clear(void) {
+  int i;
+
+  pthread_mutex_lock(&lock);
+  while (packing)
+    pthread_cond_wait(&done, &lock);
+  for (i = 0; i < qcount; i++)
+    linefree(queue[(qhead + i) & (qsize - 1)]);
+  qhead = qcount = 0;
+  for (i = 0; i < bcount; i++)
+    free(BLOCK(i).data);
+  bhead = bcount = 0;
+  bbytes = 0;
+  for (; nspare > 0; nspare--)
+    linefree(spare[nspare - 1]);
+  first = pushed;
+  pthread_mutex_unlock(&lock);
+}
+
+/* waits until every full block of queued lines is packed */
+void history_sync(void) {
+  pthread_mutex_lock(&lock);
+  while (packing || qcount >= HIST_BLOCK)
+    pthread_cond_wait(&done, &lock);
+  pthread_mutex_unlock(&lock);
+}
+
+/* the number of packed lines, and their size in *bytes */
+size_t history_packed(size_t *bytes) {
+  size_t n;
+
+  pthread_mutex_lock(&lock);
+  n = (size_t)bcount * HIST_BLOCK;
+  *bytes = bbytes;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
@@ -0,0 +1,24 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "terminal.h"
+
+/* lines packed, and unpacked when read back, together */
+#define HIST_BLOCK 256
+
+Line history_push(Line line);
+Line history_line(int i);
+int history_count(void);
+void history_mark(uint8_t *live, uint32_t count);
+void history_clear(void);
+void history_sync(void);
+size_t history_packed(size_t *bytes);
+
+/* config.h globals */
+extern unsigned int histlines;
+extern unsigned int histmem;
+
+#endif
@@ -5,6 +5,7 @@
 #include <pway/keyboard.h>
 #include <xkbcommon/xkbcommon-keysyms.h>
 #include <xkbcommon/xkbcommon.h>
+#include <stdio.h>
 #include <string.h>
 #include "ansi_escapes.h"
 
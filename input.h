@@ -20,6 +20,31 @@
 #define Mod4Mask		(1<<6)
 #define Mod5Mask		(1<<7)
 
+/* types used in config.h */
+typedef struct {
+  uint mod;
+  xkb_keysym_t keysym;
+  void (*func)(const Arg *);
+  const Arg arg;
+} Shortcut;
+
+typedef struct {
+  uint mod;
+  uint button;
+  void (*func)(const Arg *);
+  const Arg arg;
+  uint release;
+} MouseShortcut;
+
+typedef struct {
+  xkb_keysym_t key_sym;
+  uint mask;
+  char *esc_to_print;
+  /* three-valued logic variables: 0 indifferent, 1 on, -1 off */
+  signed char appkey;    /* application keypad */
+  signed char appcursor; /* application cursor */
+} Key;
+
 char *get_esc_from_special_keys(xkb_keysym_t key_sym, uint state);
 int match(uint mask, uint state);
 void numlock(const Arg *);
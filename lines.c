@@ -0,0 +1,155 @@
+#include "lines.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/*
+ * Every line starts with a LineHead cell holding its width and how many
+ * cells were allocated for it. Lines are carved out of LINE_SLAB slabs one
+ * after the other rather than each malloc()ed on its own, so the rows of a
+ * screen sit next to each other. Widths, with that cell, are rounded up to
+ * LINE_ROUND cells, whole cache lines, so widening the window by a few
+ * columns mostly leaves lines where they are. A freed line goes on the
+ * free list of its allocated size and is handed out again, for that size
+ * or a narrower line, before the slab is cut any further; slabs are never
+ * given back. Lines are allocated and freed under the term lock.
+ */
+#define LINE_SLAB (2 << 20)
+#define LINE_ROUND 8
+#define ROUNDWIDTH(w) (((w) + LINE_ROUND - 1) / LINE_ROUND * LINE_ROUND)
+
+typedef struct FreeLine {
+  struct FreeLine *next;
+} FreeLine;
+
+typedef struct Width {
+  struct Width *next;
+  int width;
+  FreeLine *free;
+} Width;
+
+static Width *widths; /* most recently used first */
+static char *slab, *slabend;
+static int mode = -1;
+
+static Width *widthof(int width) {
+  Width **pw, *w;
+
+  for (pw = &widths; (w = *pw); pw = &w->next) {
+    if (w->width == width) {
+      *pw = w->next;
+      break;
+    }
+  }
+  if (!w) {
+    w = xmalloc(sizeof(*w));
+    *w = (Width){.width = width};
+  }
+  w->next = widths;
+  widths = w;
+  return w;
+}
+
+/* a LINE_SLAB aligned slab, so it can be backed by huge pages */
+static void slabnew(size_t size) {
+  char *p;
+  size_t lead;
+
+  size = (size + LINE_SLAB - 1) / LINE_SLAB * LINE_SLAB;
+  p = mmap(NULL, size + LINE_SLAB, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    die("mmap: %s\n", strerror(errno));
+  lead = (LINE_SLAB - (uintptr_t)p % LINE_SLAB) % LINE_SLAB;
+  if (lead)
+    munmap(p, lead);
+  munmap(p + lead + size, LINE_SLAB - lead);
+  slab = p + lead;
+  slabend = slab + size;
+#ifdef MADV_HUGEPAGE
+  if (mode == 2)
+    madvise(slab, size, MADV_HUGEPAGE);
+#endif
+}
+
+Line linealloc(int width) {
+  size_t size;
+  Width *w;
+  Line line;
+  int cells;
+
+  if (mode < 0)
+    mode = lineslab;
+  if (!mode) {
+    line = xmalloc((width + 1) * sizeof(PGlyph));
+    cells = width + 1;
+  } else {
+    cells = ROUNDWIDTH(width + 1);
+    w = widthof(cells);
+    if (!w->free) {
+      /* a wider free line will do, it goes back to its own list */
+      for (w = widths; w; w = w->next) {
+        if (w->free && w->width > cells)
+          break;
+      }
+    }
+    if (w) {
+      line = (Line)w->free;
+      w->free = w->free->next;
+      cells = w->width;
+    } else {
+      size = cells * sizeof(PGlyph);
+      if ((size_t)(slabend - slab) < size)
+        slabnew(size);
+      line = (Line)slab;
+      slab += size;
+    }
+  }
+  line++;
+  *LINEHEAD(line) = (LineHead){.width = width, .cells = cells};
+  return line;
+}
+
+void linefree(Line line) {
+  FreeLine *f;
+  Width *w;
+
+  if (!line)
+    return;
+  if (!mode) {
+    free(line - 1);
+    return;
+  }
+  w = widthof(LINEHEAD(line)->cells);
+  f = (FreeLine *)LINEHEAD(line);
+  f->next = w->free;
+  w->free = f;
+}
+
+/* line as newwidth cells, the first of them kept */
+Line lineresize(Line line, int newwidth) {
+  Line new;
+  int width;
+
+  if (mode < 0)
+    mode = lineslab;
+  if (!line)
+    return linealloc(newwidth);
+  width = LINEWIDTH(line);
+  if (!mode) {
+    new = (Line)xrealloc(LINEHEAD(line), (newwidth + 1) * sizeof(PGlyph)) + 1;
+    *LINEHEAD(new) = (LineHead){.width = newwidth, .cells = newwidth + 1};
+    return new;
+  }
+  if (newwidth + 1 <= (int)LINEHEAD(line)->cells) {
+    LINEHEAD(line)->width = newwidth;
+    return line;
+  }
+  new = linealloc(newwidth);
+  memcpy(new, line, MIN(width, newwidth) * sizeof(PGlyph));
+  linefree(line);
+  return new;
+}
@@ -0,0 +1,22 @@
+#ifndef LINES_H
+#define LINES_H
+
+#include "terminal.h"
+
+/* the cell in front of every line from linealloc() */
+typedef struct {
+  uint32_t width; /* cells the line holds */
+  uint32_t cells; /* allocated, this one included */
+} LineHead;
+
+#define LINEHEAD(line) ((LineHead *)((line) - 1))
+#define LINEWIDTH(line) ((int)LINEHEAD(line)->width)
+
+Line linealloc(int width);
+Line lineresize(Line line, int newwidth);
+void linefree(Line line);
+
+/* config.h globals */
+extern int lineslab;
+
+#endif
@@ -12,6 +12,8 @@
 
 #include "mouse.h"
 
+#include "color.h"
+
 #include "draw.h"
 #include "terminal.h"
 #include "window.h"
@@ -21,6 +23,8 @@
 
 #include "tty.h"
 
+#include "stats.h"
+
 
 #include "pterminal.h"
 
@@ -38,18 +42,32 @@ void ttysend(const Arg *arg) {
 
 
 
+/*
+ * Runs on the parser thread with the term lock held, as do the pway
+ * callbacks that change the mode. The renderer sees it in the snapshot.
+ */
 void xsetmode(int set, unsigned int flags) {
   int mode = terminal_window.mode;
   MODBIT(terminal_window.mode, set, flags);
   if ((terminal_window.mode & MODE_REVERSE) != (mode & MODE_REVERSE))
-    redraw();
+    tfulldirt();
 }
 
 
 
+/* the main loop dumps the stats, wake it in case it sleeps */
+void handle_stats(int signal_number){
+
+  stats_signal(signal_number);
+  wake_pterminal();
+
+}
+
+/* exit_pterminal() runs once the main loop sees the flag */
 void handle_interrupt(int signal_number){
 
-  exit_pterminal();
+  stop_requested = 1;
+  wake_pterminal();
 
 }
 
@@ -60,16 +78,37 @@ void exit_pterminal(){
 
   printf("Exit pterminal\n");
 
- 
-  exit(EXIT_SUCCESS);
+  /* keeps the parser thread out of the terminal while atexit() runs */
+  tlock();
+  ttyexit();
 
 }
 
 
+static void usage(const char *argv0) {
+  die("usage: %s [-l scrollback lines]\n", argv0);
+}
+
 int main(int argc, char *argv[]) {
+  int c;
 
-  signal(SIGINT, handle_interrupt);
+  while ((c = getopt(argc, argv, "l:")) != -1) {
+    switch (c) {
+    case 'l': histlines = MAX(atoi(optarg), 0); break;
+    default: usage(argv[0]);
+    }
+  }
 
+  signal(SIGINT, handle_interrupt);
+  signal(SIGUSR1, handle_stats);
+  atexit(stats_dump);
+
+  terminal_callbacks.ttywrite = write_to_tty;
+  terminal_callbacks.getcolor = xgetcolor;
+  terminal_callbacks.setcolorname = xsetcolorname;
+  terminal_callbacks.loadcols = xloadcols;
+  terminal_callbacks.setmode = xsetmode;
+  terminal_callbacks.setcursor = set_terminal_cursor;
 
   set_terminal_cursor(cursorshape);
 
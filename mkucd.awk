@@ -0,0 +1,117 @@
+# Generates ucd/width.txt from the Unicode Character Database files
+# UnicodeData.txt, EastAsianWidth.txt and PropList.txt, given in any order.
+#
+#   0  general category Mn, Me or Cf, except U+00AD SOFT HYPHEN and the
+#      Prepended_Concatenation_Mark characters; Hangul jungseong and
+#      jongseong U+1160..U+11FF and U+D7B0..U+D7FF
+#   2  East_Asian_Width W or F, unless 0 above; U+3248..U+324F and
+#      U+4DC0..U+4DFF
+#
+# Everything else is left out, runewidth() takes it as 1 column wide. The
+# Hangul and the two wide ranges are what glibc's wcwidth() makes of them,
+# applications size the text they print with it.
+
+function hex(s,    i, n) {
+	n = 0
+	for (i = 1; i <= length(s); i++)
+		n = n * 16 + index("0123456789ABCDEF", toupper(substr(s, i, 1))) - 1
+	return n
+}
+
+function trim(s) {
+	sub(/^[ \t]+/, "", s)
+	sub(/[ \t]+$/, "", s)
+	return s
+}
+
+# the code points of a field like 1100..115F, into lo and hi
+function range(s,    r) {
+	split(trim(s), r, /\.\./)
+	lo = hex(r[1])
+	hi = (2 in r) ? hex(r[2]) : lo
+}
+
+function flush(u) {
+	if (last != 1)
+		printf "%04X%s;%d\n", first, (u - 1 > first) ? sprintf("..%04X", u - 1) : "", last
+}
+
+BEGIN {
+	FS = ";"
+}
+
+# the first line names the file and its version, e.g. # PropList-15.1.0.txt
+FNR == 1 && match($0, /-[0-9]+\.[0-9]+\.[0-9]+\.txt/) {
+	version = substr($0, RSTART + 1, RLENGTH - 5)
+}
+
+/^#/ || NF < 2 {
+	next
+}
+
+{
+	sub(/#.*/, "")
+}
+
+FILENAME ~ /UnicodeData/ {
+	u = hex($1)
+	if ($3 == "Mn" || $3 == "Me" || $3 == "Cf")
+		zero[u] = 1
+	else if (u >= hex("1160") && u <= hex("11FF") ||
+	    u >= hex("D7B0") && u <= hex("D7FF"))
+		zero[u] = 1
+	next
+}
+
+FILENAME ~ /EastAsianWidth/ {
+	if (trim($2) == "W" || trim($2) == "F") {
+		range($1)
+		for (u = lo; u <= hi; u++)
+			wide[u] = 1
+	}
+	next
+}
+
+FILENAME ~ /PropList/ {
+	if (trim($2) == "Prepended_Concatenation_Mark") {
+		range($1)
+		for (u = lo; u <= hi; u++)
+			pcm[u] = 1
+	}
+	next
+}
+
+END {
+	delete zero[hex("00AD")]
+	for (u in pcm)
+		delete zero[u]
+	for (u = hex("3248"); u <= hex("324F"); u++)
+		wide[u] = 1
+	for (u = hex("4DC0"); u <= hex("4DFF"); u++)
+		wide[u] = 1
+
+	print "# Column widths of code points for runewidth(), generated by"
+	print "# mkucd.awk from the Unicode " version " Character Database:"
+	print "#"
+	print "#   0  general category Mn, Me or Cf, except U+00AD SOFT HYPHEN and"
+	print "#      the Prepended_Concatenation_Mark characters; Hangul jungseong"
+	print "#      and jongseong U+1160..U+11FF and U+D7B0..U+D7FF"
+	print "#   2  East_Asian_Width W or F in EastAsianWidth.txt, and like"
+	print "#      glibc U+3248..U+324F and U+4DC0..U+4DFF"
+	print "#"
+	print "# Unassigned code points and everything not listed is 1 column wide."
+	print "# mkwidth.awk turns this file into the lookup tables of runewidth.h at"
+	print "# build time. Run make unicode to regenerate it, do not edit."
+	print "#"
+
+	last = 1
+	for (u = 0; u <= 1114111; u++) {
+		w = (u in zero) ? 0 : (u in wide) ? 2 : 1
+		if (w != last) {
+			flush(u)
+			first = u
+			last = w
+		}
+	}
+	flush(u)
+}
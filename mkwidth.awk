@@ -0,0 +1,79 @@
+# Generates runewidth.h from ucd/width.txt.
+#
+# The widths (0, 1 or 2) of all code points are split into blocks of 256,
+# identical blocks are stored once and packed four widths to a byte.
+# runewidth1 maps the upper bits of a rune to its block in runewidth2.
+
+function hex(s,    i, n) {
+	n = 0
+	for (i = 1; i <= length(s); i++)
+		n = n * 16 + index("0123456789ABCDEF", toupper(substr(s, i, 1))) - 1
+	return n
+}
+
+BEGIN {
+	FS = ";"
+	nblocks = 0
+}
+
+/^#/ || NF < 2 {
+	next
+}
+
+{
+	split($1, r, /\.\./)
+	lo = hex(r[1])
+	hi = (2 in r) ? hex(r[2]) : lo
+	delete r
+	for (u = lo; u <= hi; u++)
+		width[u] = $2 + 0
+}
+
+END {
+	for (b = 0; b < 4352; b++) {
+		key = ""
+		for (u = b * 256; u < (b + 1) * 256; u++)
+			key = key ((u in width) ? width[u] : 1)
+		if (!(key in blockof)) {
+			blockof[key] = nblocks
+			blocks[nblocks++] = key
+		}
+		stage1[b] = blockof[key]
+	}
+
+	print "/* generated by mkwidth.awk from ucd/width.txt, do not edit */"
+	print "#ifndef RUNEWIDTH_H"
+	print "#define RUNEWIDTH_H"
+	print ""
+	print "#include \"terminal.h\""
+	print ""
+	printf "static const unsigned char runewidth1[4352] = {"
+	for (b = 0; b < 4352; b++)
+		printf "%s%d,", (b % 16) ? " " : "\n  ", stage1[b]
+	print "\n};"
+	print ""
+	printf "static const unsigned char runewidth2[%d][64] = {\n", nblocks
+	for (i = 0; i < nblocks; i++) {
+		printf "  {"
+		for (j = 0; j < 64; j++) {
+			v = 0
+			for (k = 3; k >= 0; k--)
+				v = v * 4 + substr(blocks[i], j * 4 + k + 1, 1)
+			printf "%s0x%02x,", (j % 12) ? " " : "\n    ", v
+		}
+		print "\n  },"
+	}
+	print "};"
+	print ""
+	print "/* number of columns taken by u, like wcwidth() for printable runes */"
+	print "static inline int runewidth(Rune u) {"
+	print "  const unsigned char *b;"
+	print ""
+	print "  if (u > 0x10FFFF)"
+	print "    return 1;"
+	print "  b = runewidth2[runewidth1[u >> 8]];"
+	print "  return (b[(u & 0xff) >> 2] >> ((u & 3) * 2)) & 3;"
+	print "}"
+	print ""
+	print "#endif"
+}
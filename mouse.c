@@ -228,14 +228,3 @@ void send_mouse_info_to_tty() {
 bool is_on_mouse_mode(){
   return IS_WINDOSET(MODE_MOUSE);
 }
-
-
-void selclear(void) {
-  if (selection.original_beginning.x == -1)
-    return;
-  selection.mode = SEL_IDLE;
-  selection.original_beginning.x = -1;
-  tsetdirt(selection.beginning_normalized.y, selection.end_normalized.y);
-}
-
-
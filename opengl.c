@@ -1,10 +1,12 @@
 #include "opengl.h"
 
 #include <GL/gl.h>
+#include <EGL/eglext.h>
 
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 
 #if __has_include("./lib/lodepng.h")
@@ -16,90 +18,176 @@
 
 #include "font.h"
 
-typedef struct UV{
-    float x;
-    float y;
-}UV;
+/* one corner of a queued quad, untextured quads leave s and t at 0 */
+typedef struct Vertex {
+  GLfloat x, y;
+  GLfloat s, t;
+  GLfloat r, g, b;
+} Vertex;
+
+typedef struct VertexBatch {
+  Vertex *vertices;
+  size_t len, cap;
+} VertexBatch;
 
 GLuint font_texture_id;
 
+/* backgrounds and glyphs queued since the last gl_flush() */
+static VertexBatch background_batch;
+static VertexBatch glyph_batch;
+
+static Vertex *batch_quad(VertexBatch *batch) {
+  if (batch->len + 4 > batch->cap) {
+    batch->cap = MAX(batch->cap * 2, 4096);
+    batch->vertices = xrealloc(batch->vertices, batch->cap * sizeof(Vertex));
+  }
+  batch->len += 4;
+  return batch->vertices + batch->len - 4;
+}
+
+static void set_vertex(Vertex *v, float x, float y, float s, float t,
+                       PColor color) {
+  v->x = x;
+  v->y = y;
+  v->s = s;
+  v->t = t;
+  v->r = color.r;
+  v->g = color.g;
+  v->b = color.b;
+}
+
+static void draw_batch(VertexBatch *batch) {
+  if (batch->len == 0)
+    return;
+
+  glVertexPointer(2, GL_FLOAT, sizeof(Vertex), &batch->vertices->x);
+  glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), &batch->vertices->s);
+  glColorPointer(3, GL_FLOAT, sizeof(Vertex), &batch->vertices->r);
+  glDrawArrays(GL_QUADS, 0, batch->len);
+  batch->len = 0;
+}
+
 void gl_draw_rect(PColor color,  float x, float y, float width, float height){
-    glColor4f(color.r, color.g, color.b,1.f); 
-
-    glBegin(GL_QUADS);
-        glVertex3f(x, y,-1);
-        glVertex3f(x + width, y,-1);
-        glVertex3f(x + width, y + height,-1);
-        glVertex3f(x, y + height,-1);
-    glEnd();
- 
-    //debug grid red border line
-    // glColor4f(1, 0, 0,1.f); 
-    // glLineWidth(1);
-    // glBegin(GL_LINE_LOOP);
-    //     glVertex3f(x, y,-1);
-    //     glVertex3f(x + width, y,-1);
-    //     glVertex3f(x + width, y + height,-1);
-    //     glVertex3f(x, y + height,-1);
-    // glEnd();
+  Vertex *v = batch_quad(&background_batch);
+
+  set_vertex(&v[0], x, y, 0, 0, color);
+  set_vertex(&v[1], x + width, y, 0, 0, color);
+  set_vertex(&v[2], x + width, y + height, 0, 0, color);
+  set_vertex(&v[3], x, y + height, 0, 0, color);
 }
 
 void gl_draw_char(uint8_t character, PColor color, float x, float y,
-                  float width, float height) {
-
-  float char_x = character % 16;
-  float char_y = floor((float)character / 16);
+                  float width, float height, float clip_x, float clip_y,
+                  float clip_width, float clip_height) {
 
   float char_size_x = 32.f / 512.f;
   float char_size_y = 32.f / 512.f;
 
-  UV uv1;
-  UV uv2;
-  UV uv3;
-  UV uv4;
+  float char_x = (character % 16) * char_size_x;
+  float char_y = (character / 16) * char_size_y;
+
+  /* cut the quad and its texture coordinates down to the cell */
+  float x1 = MAX(x, clip_x);
+  float y1 = MAX(y, clip_y);
+  float x2 = MIN(x + width, clip_x + clip_width);
+  float y2 = MIN(y + height, clip_y + clip_height);
 
-  // button left
-  uv1.x = char_x * char_size_x;
-  uv1.y = char_y * char_size_y;
+  float s1 = char_x + (x1 - x) / width * char_size_x;
+  float t1 = char_y + (y1 - y) / height * char_size_y;
+  float s2 = char_x + (x2 - x) / width * char_size_x;
+  float t2 = char_y + (y2 - y) / height * char_size_y;
 
-  // button right
-  uv2.x = (char_x + 1) * char_size_x;
-  uv2.y = char_y * char_size_y;
+  Vertex *v;
 
-  // top right
-  uv3.x = (char_x + 1) * char_size_x;
-  uv3.y = (char_y + 1) * char_size_y;
+  if (x1 >= x2 || y1 >= y2)
+    return;
 
-  // top left
-  uv4.x = char_x * char_size_x;
-  uv4.y = (char_y + 1) * char_size_y;
+  v = batch_quad(&glyph_batch);
+  set_vertex(&v[0], x1, y1, s1, t1, color);
+  set_vertex(&v[1], x2, y1, s2, t1, color);
+  set_vertex(&v[2], x2, y2, s2, t2, color);
+  set_vertex(&v[3], x1, y2, s1, t2, color);
+}
 
-  float alpha_value = 0.f;
+/*
+ * Draws everything queued by gl_draw_rect() and gl_draw_char(), all
+ * backgrounds first and all glyphs on top, with one draw call each.
+ */
+void gl_flush(void) {
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
 
-  glEnable(GL_BLEND);
-  glEnable(GL_TEXTURE_2D);
+  draw_batch(&background_batch);
 
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  if (glyph_batch.len > 0) {
+    glEnable(GL_BLEND);
+    glEnable(GL_TEXTURE_2D);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glBindTexture(GL_TEXTURE_2D, font_texture_id);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
 
-  glBindTexture(GL_TEXTURE_2D, font_texture_id);
+    draw_batch(&glyph_batch);
 
-  glColor3f(color.r, color.g, color.b);
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisable(GL_TEXTURE_2D);
+    glDisable(GL_BLEND);
+  }
 
-  glBegin(GL_QUADS);
-  glTexCoord2f(uv1.x, uv1.y);
-  glVertex2f(x, y);
-  glTexCoord2f(uv2.x, uv2.y);
-  glVertex2f(x + width, y);
-  glTexCoord2f(uv3.x, uv3.y);
-  glVertex2f(x + width, y + height);
-  glTexCoord2f(uv4.x, uv4.y);
-  glVertex2f(x, y + height);
-  glEnd();
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+}
+static bool has_egl_extension(EGLDisplay display, const char *name) {
+  const char *list = eglQueryString(display, EGL_EXTENSIONS);
+  size_t len = strlen(name);
+
+  while (list && (list = strstr(list, name))) {
+    if (list[len] == ' ' || list[len] == '\0')
+      return true;
+    list += len;
+  }
+  return false;
+}
 
-  glDisable(GL_TEXTURE_2D);
+/* frames since the back buffer was on screen, 0 if its content is unknown */
+int gl_buffer_age(void) {
+  static int supported = -1;
+  EGLDisplay display = eglGetCurrentDisplay();
+  EGLint age;
 
-  glDisable(GL_BLEND);
+  if (supported == -1)
+    supported = has_egl_extension(display, "EGL_EXT_buffer_age");
+
+  if (!supported || !eglQuerySurface(display, eglGetCurrentSurface(EGL_DRAW),
+                                     EGL_BUFFER_AGE_EXT, &age))
+    return 0;
+  return age;
+}
+
+/*
+ * Swaps and tells the compositor which rectangles changed. Returns false
+ * without swapping when the driver has no swap with damage.
+ */
+bool gl_swap_buffers_with_damage(EGLint *rects, EGLint count) {
+  static PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_with_damage;
+  static bool looked_up;
+  EGLDisplay display = eglGetCurrentDisplay();
+
+  if (!looked_up) {
+    if (has_egl_extension(display, "EGL_KHR_swap_buffers_with_damage"))
+      swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress(
+          "eglSwapBuffersWithDamageKHR");
+    else if (has_egl_extension(display, "EGL_EXT_swap_buffers_with_damage"))
+      swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress(
+          "eglSwapBuffersWithDamageEXT");
+    looked_up = true;
+  }
+
+  if (!swap_with_damage)
+    return false;
+  return swap_with_damage(display, eglGetCurrentSurface(EGL_DRAW), rects,
+                          count);
 }
+
 void set_ortho_projection(float width, float height){
 
 
@@ -15,7 +15,13 @@ void load_font_image(GLuint* texture_pointer);
 void gl_draw_rect(PColor color,  float x, float y, float width, float height);
 
 void gl_draw_char(uint8_t character, PColor color, float x, float y,
-                  float width, float height);
+                  float width, float height, float clip_x, float clip_y,
+                  float clip_width, float clip_height);
+
+void gl_flush(void);
+
+int gl_buffer_age(void);
+bool gl_swap_buffers_with_damage(EGLint *rects, EGLint count);
 
 extern int gl_attributes[4];
 
@@ -0,0 +1,201 @@
+#include "printer.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "terminal.h"
+
+/*
+ * Printer output (MODE_PRINT, media copy) for iofd. tprinter() only
+ * copies into a queue of chunks, a thread of its own writes them out with
+ * writev(), so a slow file or pipe never holds up the parser. The thread
+ * starts with the first output and sleeps while the queue is empty.
+ */
+#define PRINTER_CHUNK (64 * 1024)
+#define PRINTER_IOV 64
+#define PRINTER_LINGER 10 /* ms to wait for more before writing a part chunk */
+
+typedef struct Chunk {
+  struct Chunk *next;
+  size_t len;
+  char buf[PRINTER_CHUNK];
+} Chunk;
+
+enum { WAIT_NONE, WAIT_ANY, WAIT_CHUNK };
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_t thread;
+static int started, stopping, waiting, registered;
+static Chunk *head, *tail, *spare;
+static size_t queued, writing, dropped;
+
+/* writes all of iov, false on an error */
+static int writeall(int fd, struct iovec *iov, int n) {
+  ssize_t r;
+
+  while (n > 0) {
+    if ((r = writev(fd, iov, n)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return 0;
+    }
+    for (; n > 0 && (size_t)r >= iov->iov_len; iov++, n--)
+      r -= iov->iov_len;
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + r;
+      iov->iov_len -= r;
+    }
+  }
+  return 1;
+}
+
+static void *writer(void *arg) {
+  struct iovec iov[PRINTER_IOV];
+  struct timespec deadline;
+  Chunk *list, *c, *next;
+  sigset_t all;
+  size_t lost;
+  int fd, n, ok;
+
+  /* signals are for the main thread, see sigchld() */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+  pthread_mutex_lock(&lock);
+  for (;;) {
+    if (!head && !stopping) {
+      waiting = WAIT_ANY;
+      pthread_cond_wait(&cond, &lock);
+      continue;
+    }
+    if (queued < PRINTER_CHUNK && !stopping) {
+      /* a part chunk, give the parser a moment to add to it */
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_nsec += PRINTER_LINGER * 1000000L;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+      }
+      waiting = WAIT_CHUNK;
+      while (queued < PRINTER_CHUNK && !stopping &&
+             pthread_cond_timedwait(&cond, &lock, &deadline) != ETIMEDOUT)
+        ;
+    }
+    waiting = WAIT_NONE;
+    if (!head)
+      break;
+
+    list = head;
+    head = tail = NULL;
+    writing = queued;
+    queued = 0;
+    lost = dropped;
+    dropped = 0;
+    fd = iofd;
+    pthread_mutex_unlock(&lock);
+
+    if (lost)
+      fprintf(stderr, "printer: output fell behind, %zu bytes dropped\n",
+              lost);
+    for (ok = 1, c = list; c && ok;) {
+      for (n = 0; c && n < PRINTER_IOV; c = c->next, n++)
+        iov[n] = (struct iovec){.iov_base = c->buf, .iov_len = c->len};
+      ok = fd == -1 || writeall(fd, iov, n);
+    }
+    if (!ok) {
+      perror("Error writing to output file");
+      close(fd);
+    }
+
+    pthread_mutex_lock(&lock);
+    if (!ok)
+      iofd = -1;
+    writing = 0;
+    for (c = list; c; c = next) {
+      next = c->next;
+      if (!spare) {
+        c->next = NULL;
+        spare = c;
+      } else {
+        free(c);
+      }
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return NULL;
+}
+
+void printer_write(const char *s, size_t len) {
+  Chunk *c;
+  size_t n;
+
+  pthread_mutex_lock(&lock);
+  if (iofd == -1) {
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  if (!started) {
+    if (pthread_create(&thread, NULL, writer, NULL) != 0)
+      die("couldn't start the printer thread\n");
+    started = 1;
+    if (!registered++)
+      atexit(printer_flush);
+  }
+  if (queued + writing + len > PRINTER_MAX) {
+    dropped += len;
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+
+  queued += len;
+  while (len > 0) {
+    if (!tail || tail->len == PRINTER_CHUNK) {
+      if (spare) {
+        c = spare;
+        spare = NULL;
+      } else {
+        c = xmalloc(sizeof(*c));
+      }
+      c->next = NULL;
+      c->len = 0;
+      if (tail)
+        tail->next = c;
+      else
+        head = c;
+      tail = c;
+    }
+    n = MIN(len, PRINTER_CHUNK - tail->len);
+    memcpy(tail->buf + tail->len, s, n);
+    tail->len += n;
+    s += n;
+    len -= n;
+  }
+
+  if (waiting == WAIT_ANY ||
+      (waiting == WAIT_CHUNK && queued >= PRINTER_CHUNK))
+    pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&lock);
+}
+
+/* writes out what is queued and stops the thread, at exit */
+void printer_flush(void) {
+  pthread_mutex_lock(&lock);
+  if (!started) {
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+  stopping = 1;
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&lock);
+
+  pthread_join(thread, NULL);
+  started = stopping = 0;
+}
@@ -0,0 +1,12 @@
+#ifndef PRINTER_H
+#define PRINTER_H
+
+#include <stddef.h>
+
+/* queued bytes past which printer output is dropped */
+#define PRINTER_MAX (64 << 20)
+
+void printer_write(const char *s, size_t len);
+void printer_flush(void);
+
+#endif
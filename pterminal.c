@@ -1,20 +1,33 @@
 #include "pterminal.h"
 
+#include <errno.h>
+#include <pthread.h>
 #include <pway/pway.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/eventfd.h>
 #include <sys/poll.h>
+#include <time.h>
 #include <unistd.h>
 #include "window.h"
 
 #include "tty.h"
 
 #include "draw.h"
+#include "snapshot.h"
+#include "stats.h"
 
 bool can_draw;
 
 static char *shell = "/bin/sh";
 
+/* written by the parser thread for every snapshot it publishes */
+static int wakefd = -1;
+
+/* set by signal handlers, the main loop ends and main() exits */
+volatile sig_atomic_t stop_requested;
+
 int set_terminal_cursor(int cursor) {
   if (!BETWEEN(cursor, 0, 7)) /* 7: st extension */
     return 1;
@@ -22,26 +35,105 @@ int set_terminal_cursor(int cursor) {
   return 0;
 }
 
-void *run_pterminal(void *none) {
+/*
+ * The parser thread: drains the pty as fast as the child writes, whatever
+ * the main thread is blocked in, and hands the screen over once idle.
+ */
+static void *parse_pty(void *none) {
+  struct pollfd tty = {.fd = ttywaitfd, .events = POLLIN};
+  struct timespec trigger;
+  uint64_t one = 1;
+  sigset_t all;
+
+  /* signals go to the main thread, its poll is what they need to wake */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+  for (;;) {
+    ttyflush();
+    /* errors too, read_tty() exits or dies on them instead of spinning */
+    if (poll(&tty, 1, -1) <= 0 ||
+        !(tty.revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)))
+      continue;
+
+    clock_gettime(CLOCK_MONOTONIC, &trigger);
+    while (!read_tty_until_idle(&trigger))
+      ;
+
+    tlock();
+    snapshot_publish(terminal_window.mode, terminal_window.cursor);
+    tunlock();
+    if (write(wakefd, &one, sizeof(one)) < 0)
+      perror("couldn't wake the renderer");
+    /* the main loop exits, from its own thread */
+    if (ttyexited)
+      return NULL;
+  }
+  return NULL;
+}
+
+/*
+ * Safe in a signal handler: makes the main loop look at the flags. Without
+ * the parser thread there is nothing to write to, the signal interrupting
+ * the main thread's poll does it then.
+ */
+void wake_pterminal(void) {
+  uint64_t one = 1;
+  int saved = errno;
+
+  if (wakefd >= 0 && write(wakefd, &one, sizeof(one)) < 0) {
+    /* nothing to be done about it in a handler */
+  }
+  errno = saved;
+}
 
-  fd_set read_file_descriptor;
+void *run_pterminal(void *none) {
 
+  struct timespec trigger;
+  bool reading = false;
+  pthread_t parser;
+  uint64_t published;
   int tty_fd;
 
 
   tty_fd = ttynew(NULL, shell, NULL, NULL);
-
-  pway_set_app_fd(tty_fd);
+  snapshot_publish(terminal_window.mode, terminal_window.cursor);
+
+  if (parsethread) {
+    if ((wakefd = eventfd(0, EFD_NONBLOCK)) < 0)
+      die("eventfd failed\n");
+    if (pthread_create(&parser, NULL, parse_pty, NULL) != 0)
+      die("couldn't start the parser thread\n");
+    pway_set_app_fd(wakefd);
+  } else {
+    pway_set_app_fd(tty_fd);
+  }
 
   printf("running pterminal\n");
 
-  while (terminal_window.is_running) {
+  while (terminal_window.is_running && !stop_requested && !ttyexited) {
     
+    /* input first, read_tty_until_idle() yields to it under a flood */
     pway_handle_events();
-
-    if( pway_app_has_event() ){
-      read_tty();
-      can_draw = true;
+    ttyflush();
+
+    if (parsethread) {
+      /* one frame for any number of snapshots, the latest is drawn */
+      if (pway_app_has_event() &&
+          read(wakefd, &published, sizeof(published)) > 0)
+        can_draw = true;
+    } else if( pway_app_has_event() ){
+      if (!reading) {
+        clock_gettime(CLOCK_MONOTONIC, &trigger);
+        reading = true;
+      }
+      if (read_tty_until_idle(&trigger)) {
+        tlock();
+        snapshot_publish(terminal_window.mode, terminal_window.cursor);
+        tunlock();
+        can_draw = true;
+        reading = false;
+      }
     }
 
     if(can_draw){
@@ -49,5 +141,10 @@ void *run_pterminal(void *none) {
       can_draw = false;
     }
 
+    if (stats_requested) {
+      stats_requested = 0;
+      stats_dump();
+    }
+
   }
 }
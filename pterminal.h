@@ -2,14 +2,18 @@
 #define PTERMINAL_H
 
 #include <poll.h>
+#include <signal.h>
 #include <pway/pway.h>
 
 extern PWay* pway;
 
 extern bool can_draw;
+extern volatile sig_atomic_t stop_requested;
 
-void *run_pterminal(void *none);
+/* config.h globals */
+extern int parsethread;
 
-int set_terminal_cursor(int cursor);
+void *run_pterminal(void *none);
+void wake_pterminal(void);
 
 #endif
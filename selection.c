@@ -2,8 +2,6 @@
 #include "terminal.h"
 #include "utf8.h"
 
-#include <pway/pway.h>
-
 Selection selection;
 
 void selinit(void) {
@@ -12,6 +10,14 @@ void selinit(void) {
   selection.original_beginning.x = -1;
 }
 
+void selclear(void) {
+  if (selection.original_beginning.x == -1)
+    return;
+  selection.mode = SEL_IDLE;
+  selection.original_beginning.x = -1;
+  tsetdirt(selection.beginning_normalized.y, selection.end_normalized.y);
+}
+
 void selstart(int col, int row, int snap) {
   selclear();
   selection.mode = SEL_EMPTY;
@@ -99,21 +105,23 @@ void selnormalize(void) {
 }
 
 int selected(int x, int y) {
-  if (selection.mode == SEL_EMPTY || selection.original_beginning.x == -1 ||
-      selection.alt != IS_SET(MODE_ALTSCREEN))
+  return inselection(&selection, IS_SET(MODE_ALTSCREEN), x, y);
+}
+
+/* whether x, y is in sel with the alternate screen shown or not */
+int inselection(const Selection *sel, int alt, int x, int y) {
+  if (sel->mode == SEL_EMPTY || sel->original_beginning.x == -1 ||
+      sel->alt != alt)
     return 0;
 
-  if (selection.type == SEL_RECTANGULAR)
-    return BETWEEN(y, selection.beginning_normalized.y,
-                   selection.end_normalized.y) &&
-           BETWEEN(x, selection.beginning_normalized.x,
-                   selection.end_normalized.x);
-
-  return BETWEEN(y, selection.beginning_normalized.y,
-                 selection.end_normalized.y) &&
-         (y != selection.beginning_normalized.y ||
-          x >= selection.beginning_normalized.x) &&
-         (y != selection.end_normalized.y || x <= selection.end_normalized.x);
+  if (sel->type == SEL_RECTANGULAR)
+    return BETWEEN(y, sel->beginning_normalized.y, sel->end_normalized.y) &&
+           BETWEEN(x, sel->beginning_normalized.x, sel->end_normalized.x);
+
+  return BETWEEN(y, sel->beginning_normalized.y, sel->end_normalized.y) &&
+         (y != sel->beginning_normalized.y ||
+          x >= sel->beginning_normalized.x) &&
+         (y != sel->end_normalized.y || x <= sel->end_normalized.x);
 }
 
 void selsnap(int *x, int *y, int direction) {
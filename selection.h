@@ -32,6 +32,7 @@ void selstart(int col, int row, int snap);
 
 void selextend(int, int, int, int);
 int selected(int, int);
+int inselection(const Selection *, int, int, int);
 
 char * get_selection(void);
 
@@ -0,0 +1,88 @@
+#include "snapshot.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+/* set in middle while the snapshot there was not taken yet */
+#define SNAP_FRESH 4
+
+/*
+ * Triple buffer: the parser fills back and the renderer reads front, each
+ * swaps its own with middle in a single exchange, so neither one waits.
+ */
+static Snapshot slots[3];
+static int back = 0, front = 1;
+static atomic_int middle = 2;
+
+/* seq of the snapshot each row of term last changed in */
+static uint64_t *row_seq;
+static int seq_row, seq_col;
+static uint64_t seq;
+
+/*
+ * Copies what changed on screen since the last call into a snapshot for
+ * the renderer and clears term.dirty, with the window modes and cursor
+ * shape the parser may have set. Called with the term lock held.
+ */
+void snapshot_publish(int winmode, int cursor) {
+  Snapshot *s = &slots[back];
+  int y;
+
+  seq++;
+  if (seq_row != term.row || seq_col != term.col) {
+    row_seq = xrealloc(row_seq, term.row * sizeof(*row_seq));
+    seq_row = term.row;
+    seq_col = term.col;
+    tfulldirt();
+  }
+  for (y = 0; y < term.row; y++) {
+    if (term.dirty[y]) {
+      term.dirty[y] = 0;
+      row_seq[y] = seq;
+    }
+  }
+
+  if (s->row != term.row || s->col != term.col) {
+    s->glyphs = xrealloc(s->glyphs, term.row * term.col * sizeof(PGlyph));
+    s->row_seq = xrealloc(s->row_seq, term.row * sizeof(*s->row_seq));
+    s->row = term.row;
+    s->col = term.col;
+    s->seq = 0;
+  }
+  /* the slot is a few snapshots old, bring the rows changed since up */
+  for (y = 0; y < term.row; y++) {
+    if (row_seq[y] > s->seq)
+      memcpy(SNAPLINE(s, y), TLINE(y), term.col * sizeof(PGlyph));
+  }
+  memcpy(s->row_seq, row_seq, term.row * sizeof(*row_seq));
+  s->seq = seq;
+  s->cursor_x = term.cursor.x;
+  s->cursor_y = term.cursor.y;
+  s->alt = IS_SET(MODE_ALTSCREEN);
+  s->sel = selection;
+  s->winmode = winmode;
+  s->cursor = cursor;
+
+  back = atomic_exchange(&middle, back | SNAP_FRESH) & ~SNAP_FRESH;
+}
+
+/* the latest published snapshot, it stays valid until the next call */
+const Snapshot *snapshot_take(void) {
+  if (atomic_load(&middle) & SNAP_FRESH)
+    front = atomic_exchange(&middle, front) & ~SNAP_FRESH;
+  return &slots[front];
+}
+
+/* marks the styles of the glyphs in every slot, see stylecollect() */
+void snapshot_mark(uint8_t *live, uint32_t count) {
+  const PGlyph *g, *end;
+  int i;
+
+  for (i = 0; i < LEN(slots); i++) {
+    end = slots[i].glyphs + slots[i].row * slots[i].col;
+    for (g = slots[i].glyphs; g < end; g++) {
+      if (g->style < count)
+        live[g->style] = 1;
+    }
+  }
+}
@@ -0,0 +1,27 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#include "terminal.h"
+#include "selection.h"
+
+#define SNAPLINE(s, y) (&(s)->glyphs[(y) * (s)->col])
+
+/* the visible screen as the renderer sees it, see snapshot_publish() */
+typedef struct {
+  int row, col;
+  PGlyph *glyphs;
+  uint64_t *row_seq; /* seq of the snapshot each row last changed in */
+  uint64_t seq;
+  int cursor_x, cursor_y;
+  int alt;
+  Selection sel;
+  int winmode, cursor; /* window modes, see win_mode, and cursor shape */
+} Snapshot;
+
+void snapshot_publish(int winmode, int cursor);
+const Snapshot *snapshot_take(void);
+void snapshot_mark(uint8_t *live, uint32_t count);
+
+#endif
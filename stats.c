@@ -0,0 +1,91 @@
+#include "stats.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+Stats stats;
+volatile sig_atomic_t stats_requested;
+
+/* microseconds on the monotonic clock */
+uint64_t stats_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* records the time since start */
+void stats_add(StatsTimer *timer, uint64_t start) {
+  uint64_t us = stats_now() - start;
+  int bucket = 0;
+
+  while (bucket < STATS_BUCKETS - 1 && us >> bucket)
+    bucket++;
+
+  timer->count++;
+  timer->total += us;
+  if (us > timer->max)
+    timer->max = us;
+  timer->buckets[bucket]++;
+}
+
+static void dump_timer(FILE *fp, const char *name, const StatsTimer *timer) {
+  int i;
+
+  fprintf(fp, "%-6s %10" PRIu64 " calls %10.1f us mean %10" PRIu64 " us max\n",
+          name, timer->count,
+          timer->count ? (double)timer->total / timer->count : 0.0,
+          timer->max);
+  for (i = 0; i < STATS_BUCKETS; i++) {
+    if (!timer->buckets[i])
+      continue;
+    if (i == STATS_BUCKETS - 1)
+      fprintf(fp, "       >= %6d us %10" PRIu64 "\n", 1 << (i - 1),
+              timer->buckets[i]);
+    else
+      fprintf(fp, "       <  %6d us %10" PRIu64 "\n", 1 << i,
+              timer->buckets[i]);
+  }
+}
+
+/* appends the counters to statsfile, or writes them to stderr */
+void stats_dump(void) {
+  FILE *fp = stderr;
+
+  if (statsfile && !(fp = fopen(statsfile, "a"))) {
+    fprintf(stderr, "cannot open %s: %s\n", statsfile, strerror(errno));
+    return;
+  }
+
+  fprintf(fp, "pterminal stats\n");
+  fprintf(fp, "pty wakeups    %" PRIu64 "\n", stats.wakeups);
+  fprintf(fp, "pty reads      %" PRIu64 "\n", stats.reads);
+  fprintf(fp, "bytes read     %" PRIu64 " (%.0f per wakeup)\n",
+          stats.bytes_read,
+          stats.wakeups ? (double)stats.bytes_read / stats.wakeups : 0.0);
+  fprintf(fp, "read buffer    %" PRIu64 " bytes\n", stats.read_buffer);
+  fprintf(fp, "pty writes     %" PRIu64 "\n", stats.writes);
+  fprintf(fp, "bytes written  %" PRIu64 "\n", stats.bytes_written);
+  fprintf(fp, "bytes parsed   %" PRIu64 "\n", stats.bytes_parsed);
+  fprintf(fp, "escapes        %" PRIu64 "\n", stats.escapes);
+  fprintf(fp, "lines scrolled %" PRIu64 "\n", stats.scrolls);
+  fprintf(fp, "rows rendered  %" PRIu64 "\n", stats.rows_rendered);
+  fprintf(fp, "frames         %" PRIu64 "\n", stats.frames);
+  fprintf(fp, "frames skipped %" PRIu64 "\n", stats.frames_skipped);
+  dump_timer(fp, "parse", &stats.parse);
+  dump_timer(fp, "frame", &stats.frame);
+  dump_timer(fp, "swap", &stats.swap);
+
+  if (fp != stderr)
+    fclose(fp);
+  else
+    fflush(fp);
+}
+
+/* SIGUSR1, the main loop dumps once it is back */
+void stats_signal(int signal_number) {
+  stats_requested = 1;
+}
@@ -0,0 +1,44 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <signal.h>
+#include <stdint.h>
+
+/* power of two buckets of microseconds, the last one takes the rest */
+#define STATS_BUCKETS 20
+
+typedef struct {
+  uint64_t count;
+  uint64_t total; /* microseconds */
+  uint64_t max;
+  uint64_t buckets[STATS_BUCKETS];
+} StatsTimer;
+
+typedef struct {
+  uint64_t wakeups; /* pty became readable */
+  uint64_t reads;
+  uint64_t bytes_read;
+  uint64_t read_buffer; /* current size */
+  uint64_t writes;
+  uint64_t bytes_written;
+  uint64_t bytes_parsed;
+  uint64_t escapes;
+  uint64_t scrolls; /* lines */
+  uint64_t rows_rendered;
+  uint64_t frames;
+  uint64_t frames_skipped; /* window not visible */
+  StatsTimer parse, frame, swap;
+} Stats;
+
+extern Stats stats;
+extern volatile sig_atomic_t stats_requested;
+
+/* stats file, stderr when NULL */
+extern char *statsfile;
+
+uint64_t stats_now(void);
+void stats_add(StatsTimer *, uint64_t start);
+void stats_dump(void);
+void stats_signal(int);
+
+#endif
@@ -18,17 +18,25 @@
 #include <termios.h>
 #include <unistd.h>
 
-#include "window.h"
 
 #include "utf8.h"
+#include "runewidth.h"
 
 #include "selection.h"
 #include "tty.h"
 #include "ansi_escapes.h"
+#include "stats.h"
+#include "snapshot.h"
+#include "printer.h"
+#include "history.h"
+#include "lines.h"
 
-#include "color.h"
 #include <pthread.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 
 
 enum cursor_state {
@@ -37,6 +45,9 @@ enum cursor_state {
   CURSOR_ORIGIN = 2
 };
 
+/* runes decoded per batch in twrite() */
+#define TWRITE_RUNES 1024
+
 enum charset {
   CS_GRAPHIC0,
   CS_GRAPHIC1,
@@ -49,8 +60,32 @@ enum charset {
 
 
 
+static void nottywrite(const char *s, size_t n, int may_echo) {}
+static void nobell(void) {}
+static void notitle(const char *title) {}
+static void nosetsel(char *str) { free(str); }
+static int nogetcolor(int x, uchar *r, uchar *g, uchar *b) { return 1; }
+static int nosetcolorname(int x, const char *name) { return 1; }
+static void noloadcols(void) {}
+static void nosetmode(int set, unsigned int flags) {}
+static int nosetcursor(int cursor) { return 0; }
+
 /* Globals */
 Term term;
+static pthread_mutex_t termlock = PTHREAD_MUTEX_INITIALIZER;
+TerminalCallbacks terminal_callbacks = {
+  .ttywrite = nottywrite,
+  .bell = nobell,
+  .settitle = notitle,
+  .seticontitle = notitle,
+  .setsel = nosetsel,
+  .getcolor = nogetcolor,
+  .setcolorname = nosetcolorname,
+  .loadcols = noloadcols,
+  .setmode = nosetmode,
+  .setcursor = nosetcursor,
+};
+int iofd = 1;
 
 ssize_t xwrite(int fd, const char *s, size_t len) {
   size_t aux = len;
@@ -146,87 +181,15 @@ void die(const char *errstr, ...) {
   exit(1);
 }
 
-void execute_shell(char *cmd, char **args) {
-  char *sh, *prog, *arg;
-  const struct passwd *pw;
-
-  errno = 0;
-  if ((pw = getpwuid(getuid())) == NULL) {
-    if (errno)
-      die("getpwuid: %s\n", strerror(errno));
-    else
-      die("who are you?\n");
-  }
-
-  if ((sh = getenv("SHELL")) == NULL)
-    sh = (pw->pw_shell[0]) ? pw->pw_shell : cmd;
-
-  if (args) {
-    prog = args[0];
-    arg = NULL;
-  } else if (scroll) {
-    prog = scroll;
-    arg = utmp ? utmp : sh;
-  } else if (utmp) {
-    prog = utmp;
-    arg = NULL;
-  } else {
-    prog = sh;
-    arg = NULL;
-  }
-  DEFAULT(args, ((char *[]){prog, arg, NULL}));
-
-  unsetenv("COLUMNS");
-  unsetenv("LINES");
-  unsetenv("TERMCAP");
-  setenv("LOGNAME", pw->pw_name, 1);
-  setenv("USER", pw->pw_name, 1);
-  setenv("SHELL", sh, 1);
-  setenv("HOME", pw->pw_dir, 1);
-  setenv("TERM", termname, 1);
-
-  signal(SIGCHLD, SIG_DFL);
-  signal(SIGHUP, SIG_DFL);
-  signal(SIGINT, SIG_DFL);
-  signal(SIGQUIT, SIG_DFL);
-  signal(SIGTERM, SIG_DFL);
-  signal(SIGALRM, SIG_DFL);
-
-  execvp(prog, args);
-  printf("Exit from shell\n");
-  _exit(1);
-}
-
-void sigchld(int a) {
-  int stat;
-  pid_t p;
-
-  if ((p = waitpid(pid, &stat, WNOHANG)) < 0)
-    die("waiting for pid %hd failed: %s\n", pid, strerror(errno));
-
-  if (pid != p)
-    return;
-
-  if (WIFEXITED(stat) && WEXITSTATUS(stat))
-    die("child exited with status %d\n", WEXITSTATUS(stat));
-  else if (WIFSIGNALED(stat))
-    die("child terminated due to signal %d\n", WTERMSIG(stat));
-  _exit(0);
-}
-
-
-
 int tattrset(int attr) {
   int i, j;
-  int y = TLINEOFFSET(0);
 
   for (i = 0; i < term.row - 1; i++) {
-    Line line = TSCREEN.buffer[y];
+    Line line = TLINE(i);
     for (j = 0; j < term.col - 1; j++) {
       if (line[j].mode & attr)
         return 1;
     }
-    y = (y + 1) % TSCREEN.size;
   }
 
   return 0;
@@ -244,22 +207,164 @@ void tsetdirt(int top, int bot) {
 
 void tsetdirtattr(int attr) {
   int i, j;
-  int y = TLINEOFFSET(0);
 
   for (i = 0; i < term.row - 1; i++) {
-    Line line = TSCREEN.buffer[y];
+    Line line = TLINE(i);
     for (j = 0; j < term.col - 1; j++) {
       if (line[j].mode & attr) {
         tsetdirt(i, i);
         break;
       }
     }
-    y = (y + 1) % TSCREEN.size;
   }
 }
 
 void tfulldirt(void) { tsetdirt(0, term.row - 1); }
 
+/*
+ * Held by whoever changes term while a parser thread runs, see
+ * run_pterminal(). Without one nothing else takes it.
+ */
+void tlock(void) { pthread_mutex_lock(&termlock); }
+void tunlock(void) { pthread_mutex_unlock(&termlock); }
+
+/*
+ * Style table. term.styles never moves, the renderer reads it without the
+ * lock. Ids are found through an open addressing hash, and the ones no
+ * glyph holds any more are collected once twice as many are in use as
+ * after the last collection.
+ */
+#define STYLE_GC_MIN 4096
+
+static uint32_t *stylehash; /* id + 1, 0 for an empty slot */
+static uint32_t stylehashsize, stylecount, stylelive, stylegc;
+static uint32_t stylefree = STYLE_MAX; /* free ids, linked through fg */
+
+static uint32_t stylehashof(uint32_t fg, uint32_t bg) {
+  uint32_t h = fg * 0x9E3779B1u ^ bg;
+
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  return h ^ h >> 13;
+}
+
+static void styleinsert(uint32_t id) {
+  uint32_t h = stylehashof(term.styles[id].fg, term.styles[id].bg);
+
+  for (h &= stylehashsize - 1; stylehash[h]; h = (h + 1) & (stylehashsize - 1))
+    ;
+  stylehash[h] = id + 1;
+}
+
+static void stylegrow(void) {
+  uint32_t *old = stylehash, size = stylehashsize, h;
+
+  stylehashsize *= 2;
+  stylehash = xmalloc(stylehashsize * sizeof(*stylehash));
+  memset(stylehash, 0, stylehashsize * sizeof(*stylehash));
+  for (h = 0; h < size; h++) {
+    if (old[h])
+      styleinsert(old[h] - 1);
+  }
+  free(old);
+}
+
+static void stylemark(uint8_t *live, Line line) {
+  int x;
+
+  if (!line)
+    return;
+  for (x = 0; x < LINEWIDTH(line); x++) {
+    if (line[x].style < stylecount)
+      live[line[x].style] = 1;
+  }
+}
+
+/* frees the ids no glyph on any screen, cursor, snapshot or history holds */
+static void stylecollect(void) {
+  uint8_t *live = xmalloc(stylecount);
+  uint32_t id;
+  int i;
+
+  memset(live, 0, stylecount);
+  live[STYLE_DEFAULT] = 1;
+  live[term.cursor.attr.style] = 1;
+  for (i = 0; i < 2; i++)
+    live[term.screen[i].sc.attr.style] = 1;
+  for (i = 0; i < term.screen[0].size; i++)
+    stylemark(live, term.screen[0].buffer[i]);
+  for (i = 0; i < term.screen[1].size; i++)
+    stylemark(live, term.screen[1].buffer[i]);
+  snapshot_mark(live, stylecount);
+  history_mark(live, stylecount);
+
+  memset(stylehash, 0, stylehashsize * sizeof(*stylehash));
+  stylefree = STYLE_MAX;
+  stylelive = 0;
+  for (id = stylecount; id-- > 0;) {
+    if (live[id]) {
+      styleinsert(id);
+      stylelive++;
+    } else {
+      term.styles[id].fg = stylefree;
+      stylefree = id;
+    }
+  }
+  stylegc = MAX(stylelive * 2, STYLE_GC_MIN);
+  free(live);
+}
+
+/* forgets every id, for a new term; nothing may draw it meanwhile */
+static void stylereset(void) {
+  free(stylehash);
+  free(term.styles);
+  stylehash = NULL;
+  term.styles = NULL;
+  stylehashsize = stylecount = stylelive = stylegc = 0;
+  stylefree = STYLE_MAX;
+}
+
+/*
+ * The id of the fg and bg pair. When all STYLE_MAX are taken by live
+ * glyphs, new pairs get the default colours.
+ */
+uint32_t tstyle(uint32_t fg, uint32_t bg) {
+  uint32_t h, id;
+
+  if (!stylehash) {
+    term.styles = xmalloc(STYLE_MAX * sizeof(*term.styles));
+    stylehashsize = 2 * STYLE_GC_MIN;
+    stylehash = xmalloc(stylehashsize * sizeof(*stylehash));
+    memset(stylehash, 0, stylehashsize * sizeof(*stylehash));
+    stylegc = STYLE_GC_MIN;
+  }
+
+  h = stylehashof(fg, bg) & (stylehashsize - 1);
+  for (; (id = stylehash[h]); h = (h + 1) & (stylehashsize - 1)) {
+    if (term.styles[id - 1].fg == fg && term.styles[id - 1].bg == bg)
+      return id - 1;
+  }
+
+  if (stylelive >= stylegc || stylelive == STYLE_MAX) {
+    stylecollect();
+    if (stylelive == STYLE_MAX)
+      return STYLE_DEFAULT;
+  }
+  if (stylefree != STYLE_MAX) {
+    id = stylefree;
+    stylefree = term.styles[id].fg;
+  } else {
+    id = stylecount++;
+  }
+  term.styles[id] = (Style){.fg = fg, .bg = bg};
+  stylelive++;
+
+  if (stylelive * 2 > stylehashsize)
+    stylegrow();
+  styleinsert(id);
+  return id;
+}
+
 void tcursor(int mode) {
   if (mode == CURSOR_SAVE) {
     TSCREEN.sc = term.cursor;
@@ -271,7 +376,7 @@ void tcursor(int mode) {
 
 void treset(void) {
   int i, j;
-  PGlyph g = (PGlyph){.fg = defaultfg, .bg = defaultbg};
+  PGlyph g = (PGlyph){.style = STYLE_DEFAULT};
 
   memset(term.tabs, 0, term.col * sizeof(*term.tabs));
   for (i = tabspaces; i < term.col; i += tabspaces)
@@ -283,33 +388,35 @@ void treset(void) {
   term.charset = 0;
 
   for (i = 0; i < 2; i++) {
-    term.screen[i].sc = (TCursor){{.fg = defaultfg, .bg = defaultbg}};
+    term.screen[i].sc = (TCursor){{.style = STYLE_DEFAULT}};
     term.screen[i].cur = 0;
     term.screen[i].off = 0;
     for (j = 0; j < term.row; ++j) {
-      if (term.col != term.linelen)
+      if (!term.screen[i].buffer[j] ||
+          LINEWIDTH(term.screen[i].buffer[j]) != term.col)
         term.screen[i].buffer[j] =
-            xrealloc(term.screen[i].buffer[j], term.col * sizeof(PGlyph));
+            lineresize(term.screen[i].buffer[j], term.col);
       clearline(term.screen[i].buffer[j], g, 0, term.col);
     }
     for (j = term.row; j < term.screen[i].size; ++j) {
-      free(term.screen[i].buffer[j]);
+      linefree(term.screen[i].buffer[j]);
       term.screen[i].buffer[j] = NULL;
     }
   }
+  history_clear();
   tcursor(CURSOR_LOAD);
   term.linelen = term.col;
   tfulldirt();
 }
 
 void new_terminal(int col, int row) {
-  int i;
+  /* the history and the style table outlive term, a second one starts over */
+  history_clear();
+  stylereset();
   term = (Term){};
-  term.screen[0].buffer = xmalloc(HISTSIZE * sizeof(Line));
-  term.screen[0].size = HISTSIZE;
+  tstyle(defaultfg, defaultbg); /* STYLE_DEFAULT */
+  term.screen[0].buffer = NULL;
   term.screen[1].buffer = NULL;
-  for (i = 0; i < HISTSIZE; ++i)
-    term.screen[0].buffer[i] = NULL;
 
   resize_terminal(col, row);
   treset();
@@ -328,8 +435,8 @@ void kscrollup(const Arg *a) {
 
   if (n < 0)
     n = MAX((-n) * term.row, 1);
-  if (n > TSCREEN.size - term.row - TSCREEN.off)
-    n = TSCREEN.size - term.row - TSCREEN.off;
+  if (n > tscrollback() - TSCREEN.off)
+    n = tscrollback() - TSCREEN.off;
   while (!TLINE((int)-n))
     --n;
   TSCREEN.off += n;
@@ -358,22 +465,23 @@ void tscrolldown(int orig, int n) {
   Line temp;
 
   LIMIT(n, 0, term.bot - orig + 1);
+  stats.scrolls += n;
 
   /* Ensure that lines are allocated */
   for (i = -n; i < 0; i++) {
-    TLINE(i) = ensureline(TLINE(i));
+    TRING(i) = ensureline(TRING(i));
   }
 
   /* Shift non-scrolling areas in ring buffer */
   for (i = term.bot + 1; i < term.row; i++) {
-    temp = TLINE(i);
-    TLINE(i) = TLINE(i - n);
-    TLINE(i - n) = temp;
+    temp = TRING(i);
+    TRING(i) = TRING(i - n);
+    TRING(i - n) = temp;
   }
   for (i = 0; i < orig; i++) {
-    temp = TLINE(i);
-    TLINE(i) = TLINE(i - n);
-    TLINE(i - n) = temp;
+    temp = TRING(i);
+    TRING(i) = TRING(i - n);
+    TRING(i - n) = temp;
   }
 
   /* Scroll buffer */
@@ -390,22 +498,28 @@ void tscrollup(int orig, int n) {
   Line temp;
 
   LIMIT(n, 0, term.bot - orig + 1);
+  stats.scrolls += n;
 
-  /* Ensure that lines are allocated */
+  /* Ensure that lines are allocated, the oldest of a full ring are kept */
   for (i = term.row; i < term.row + n; i++) {
-    TLINE(i) = ensureline(TLINE(i));
+    if (TRING(i) && !IS_SET(MODE_ALTSCREEN) &&
+        TSCREEN.size >= term.row + n &&
+        histlines > (unsigned int)(TSCREEN.size - term.row)) {
+      TRING(i) = history_push(TRING(i));
+    }
+    TRING(i) = ensureline(TRING(i));
   }
 
   /* Shift non-scrolling areas in ring buffer */
   for (i = orig - 1; i >= 0; i--) {
-    temp = TLINE(i);
-    TLINE(i) = TLINE(i + n);
-    TLINE(i + n) = temp;
+    temp = TRING(i);
+    TRING(i) = TRING(i + n);
+    TRING(i + n) = temp;
   }
   for (i = term.row - 1; i > term.bot; i--) {
-    temp = TLINE(i);
-    TLINE(i) = TLINE(i + n);
-    TLINE(i + n) = temp;
+    temp = TRING(i);
+    TRING(i) = TRING(i + n);
+    TRING(i + n) = temp;
   }
 
   /* Scroll buffer */
@@ -472,7 +586,6 @@ void tmoveto(int x, int y) {
 }
 
 void tsetchar(Rune u, PGlyph *attr, int x, int y) {
-  attr->utf8_value = (int)u;
   static const char *vt100_0[62] = {
       /* 0x41 - 0x7e */
       "↑", "↓", "→", "←", "█", "▚", "☃",      /* A - G */
@@ -485,7 +598,6 @@ void tsetchar(Rune u, PGlyph *attr, int x, int y) {
       "│", "≤", "≥", "π", "≠", "£", "·",      /* x - ~ */
   };
   Line line = TLINE(y);
-  // line[x].utf8_value = u;
 
   /*
    * The table is proudly stolen from rxvt.
@@ -500,7 +612,7 @@ void tsetchar(Rune u, PGlyph *attr, int x, int y) {
       line[x + 1].u = ' ';
       line[x + 1].mode &= ~ATTR_WDUMMY;
     }
-  } else if (line[x].mode & ATTR_WDUMMY) {
+  } else if ((line[x].mode & ATTR_WDUMMY) && x > 0) {
     line[x - 1].u = ' ';
     line[x - 1].mode &= ~ATTR_WIDE;
   }
@@ -512,7 +624,7 @@ void tsetchar(Rune u, PGlyph *attr, int x, int y) {
 
 void tclearregion(int x1, int y1, int x2, int y2) {
   int x, y, L, S, temp;
-  PGlyph *gp;
+  PGlyph *gp, blank = {.u = ' ', .style = term.cursor.attr.style};
 
   if (x1 > x2)
     temp = x1, x1 = x2, x2 = temp;
@@ -531,10 +643,7 @@ void tclearregion(int x1, int y1, int x2, int y2) {
       gp = &TSCREEN.buffer[L][x];
       if (selected(x, y))
         selclear();
-      gp->fg = term.cursor.attr.fg;
-      gp->bg = term.cursor.attr.bg;
-      gp->mode = 0;
-      gp->u = ' ';
+      *gp = blank;
     }
     L = (L + 1) % TSCREEN.size;
   }
@@ -625,6 +734,7 @@ int32_t tdefcolor(const int *attr, int *npar, int l) {
 }
 
 void tsetattr(const int *attr, int l) {
+  Style pen = GLYPHSTYLE(term.cursor.attr);
   int i;
   int32_t idx;
 
@@ -634,8 +744,8 @@ void tsetattr(const int *attr, int l) {
       term.cursor.attr.mode &=
           ~(ATTR_BOLD | ATTR_FAINT | ATTR_ITALIC | ATTR_UNDERLINE | ATTR_BLINK |
             ATTR_REVERSE | ATTR_INVISIBLE | ATTR_STRUCK);
-      term.cursor.attr.fg = defaultfg;
-      term.cursor.attr.bg = defaultbg;
+      pen.fg = defaultfg;
+      pen.bg = defaultbg;
       break;
     case 1:
       term.cursor.attr.mode |= ATTR_BOLD;
@@ -686,27 +796,27 @@ void tsetattr(const int *attr, int l) {
       break;
     case 38:
       if ((idx = tdefcolor(attr, &i, l)) >= 0)
-        term.cursor.attr.fg = idx;
+        pen.fg = idx;
       break;
     case 39:
-      term.cursor.attr.fg = defaultfg;
+      pen.fg = defaultfg;
       break;
     case 48:
       if ((idx = tdefcolor(attr, &i, l)) >= 0)
-        term.cursor.attr.bg = idx;
+        pen.bg = idx;
       break;
     case 49:
-      term.cursor.attr.bg = defaultbg;
+      pen.bg = defaultbg;
       break;
     default:
       if (BETWEEN(attr[i], 30, 37)) {
-        term.cursor.attr.fg = attr[i] - 30;
+        pen.fg = attr[i] - 30;
       } else if (BETWEEN(attr[i], 40, 47)) {
-        term.cursor.attr.bg = attr[i] - 40;
+        pen.bg = attr[i] - 40;
       } else if (BETWEEN(attr[i], 90, 97)) {
-        term.cursor.attr.fg = attr[i] - 90 + 8;
+        pen.fg = attr[i] - 90 + 8;
       } else if (BETWEEN(attr[i], 100, 107)) {
-        term.cursor.attr.bg = attr[i] - 100 + 8;
+        pen.bg = attr[i] - 100 + 8;
       } else {
         fprintf(stderr, "erresc(default): gfx attr %d unknown\n", attr[i]);
         csidump();
@@ -714,6 +824,7 @@ void tsetattr(const int *attr, int l) {
       break;
     }
   }
+  term.cursor.attr.style = tstyle(pen.fg, pen.bg);
 }
 
 void tsetscroll(int t, int b) {
@@ -738,11 +849,11 @@ void tsetmode(int priv, int set, const int *args, int narg) {
     if (priv) {
       switch (*args) {
       case 1: /* DECCKM -- Cursor key */
-        xsetmode(set, MODE_APPCURSOR);
+        terminal_callbacks.setmode(set, MODE_APPCURSOR);
         printf("MODE APPCURSOR\n");
         break;
       case 5: /* DECSCNM -- Reverse video */
-        xsetmode(set, MODE_REVERSE);
+        terminal_callbacks.setmode(set, MODE_REVERSE);
         break;
       case 6: /* DECOM -- Origin */
         MODBIT(term.cursor.state, set, CURSOR_ORIGIN);
@@ -762,36 +873,36 @@ void tsetmode(int priv, int set, const int *args, int narg) {
       case 12: /* att610 -- Start blinking cursor (IGNORED) */
         break;
       case 25: /* DECTCEM -- Text Cursor Enable Mode */
-        xsetmode(!set, MODE_HIDE);
+        terminal_callbacks.setmode(!set, MODE_HIDE);
         break;
       case 9: /* X10 mouse compatibility mode */
-        xsetmode(0, MODE_MOUSE);
-        xsetmode(set, MODE_MOUSEX10);
+        terminal_callbacks.setmode(0, MODE_MOUSE);
+        terminal_callbacks.setmode(set, MODE_MOUSEX10);
         break;
       case 1000: /* 1000: report button press */
-        xsetmode(0, MODE_MOUSE);
-        xsetmode(set, MODE_MOUSEBTN);
+        terminal_callbacks.setmode(0, MODE_MOUSE);
+        terminal_callbacks.setmode(set, MODE_MOUSEBTN);
         printf("MODE MOUSE BTN\n");
 
         break;
       case 1002: /* 1002: report motion on button press */
-        xsetmode(0, MODE_MOUSE);
-        xsetmode(set, MODE_MOUSEMOTION);
+        terminal_callbacks.setmode(0, MODE_MOUSE);
+        terminal_callbacks.setmode(set, MODE_MOUSEMOTION);
         printf("MODE MOUSE MOTION\n");
         break;
       case 1003: /* 1003: enable all mouse motions */
-        xsetmode(0, MODE_MOUSE);
-        xsetmode(set, MODE_MOUSEMANY);
+        terminal_callbacks.setmode(0, MODE_MOUSE);
+        terminal_callbacks.setmode(set, MODE_MOUSEMANY);
         printf("MODE MOUSE MANY\n");
         break;
       case 1004: /* 1004: send focus events to tty */
-        xsetmode(set, MODE_FOCUS);
+        terminal_callbacks.setmode(set, MODE_FOCUS);
         break;
       case 1006: /* 1006: extended reporting mode */
-        xsetmode(set, MODE_MOUSESGR);
+        terminal_callbacks.setmode(set, MODE_MOUSESGR);
         break;
       case 1034:
-        xsetmode(set, MODE_8BIT);
+        terminal_callbacks.setmode(set, MODE_8BIT);
         break;
       case 1049: /* swap screen & set/restore cursor as xterm */
         if (!allowaltscreen)
@@ -815,7 +926,12 @@ void tsetmode(int priv, int set, const int *args, int narg) {
         tcursor((set) ? CURSOR_SAVE : CURSOR_LOAD);
         break;
       case 2004: /* 2004: bracketed paste mode */
-        xsetmode(set, MODE_BRCKTPASTE);
+        terminal_callbacks.setmode(set, MODE_BRCKTPASTE);
+        break;
+      case 2026: /* 2026: synchronized update, see tinsync() */
+        MODBIT(term.mode, set, MODE_SYNC);
+        if (set)
+          clock_gettime(CLOCK_MONOTONIC, &term.synctime);
         break;
       /* Not implemented mouse modes. See comments there. */
       case 1001: /* mouse highlight mode; can hang the
@@ -836,7 +952,7 @@ void tsetmode(int priv, int set, const int *args, int narg) {
       case 0: /* Error (IGNORED) */
         break;
       case 2:
-        xsetmode(set, MODE_KBDLOCK);
+        terminal_callbacks.setmode(set, MODE_KBDLOCK);
         break;
       case 4: /* IRM -- Insertion-replacement */
         MODBIT(term.mode, set, MODE_INSERT);
@@ -855,20 +971,72 @@ void tsetmode(int priv, int set, const int *args, int narg) {
   }
 }
 
+/*
+ * DECRQM state of a mode: 1 set, 2 reset, 0 unknown. Modes kept by the
+ * frontend are not visible here and report 0.
+ */
+int tgetmode(int priv, int mode) {
+  int set;
 
-void sendbreak(const Arg *arg) {
-  if (tcsendbreak(cmdfd, 0))
-    perror("Error sending break");
+  if (priv) {
+    switch (mode) {
+    case 6: /* DECOM -- Origin */
+      set = term.cursor.state & CURSOR_ORIGIN;
+      break;
+    case 7: /* DECAWM -- Auto wrap */
+      set = IS_SET(MODE_WRAP);
+      break;
+    case 47:
+    case 1047:
+    case 1049:
+      set = IS_SET(MODE_ALTSCREEN);
+      break;
+    case 2026:
+      set = IS_SET(MODE_SYNC);
+      break;
+    default:
+      return 0;
+    }
+  } else {
+    switch (mode) {
+    case 4: /* IRM -- Insertion-replacement */
+      set = IS_SET(MODE_INSERT);
+      break;
+    case 12: /* SRM -- Send/Receive */
+      set = !IS_SET(MODE_ECHO);
+      break;
+    case 20: /* LNM -- Linefeed/new line */
+      set = IS_SET(MODE_CRLF);
+      break;
+    default:
+      return 0;
+    }
+  }
+  return set ? 1 : 2;
 }
 
-void tprinter(char *s, size_t len) {
-  if (iofd != -1 && xwrite(iofd, s, len) < 0) {
-    perror("Error writing to output file");
-    close(iofd);
-    iofd = -1;
+/*
+ * Whether a synchronized update is open and drawing should wait. One left
+ * open for timeout ms is ended, so a program that dies halfway cannot
+ * freeze the screen.
+ */
+int tinsync(unsigned int timeout) {
+  struct timespec now;
+
+  if (!IS_SET(MODE_SYNC))
+    return 0;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (TIMEDIFF(now, term.synctime) >= timeout) {
+    term.mode &= ~MODE_SYNC;
+    return 0;
   }
+  return 1;
 }
 
+
+/* queued for iofd, see printer.c */
+void tprinter(char *s, size_t len) { printer_write(s, len); }
+
 void toggleprinter(const Arg *arg) { term.mode ^= MODE_PRINT; }
 
 void printscreen(const Arg *arg) { tdump(); }
@@ -885,16 +1053,23 @@ void tdumpsel(void) {
 }
 
 void tdumpline(int n) {
-  char buf[UTF_SIZ];
+  char buf[256 * UTF_SIZ];
   const PGlyph *bp, *end;
+  size_t len = 0;
 
   bp = &TLINE(n)[0];
   end = &bp[MIN(tlinelen(n), term.col) - 1];
   if (bp != end || bp->u != ' ') {
-    for (; bp <= end; ++bp)
-      tprinter(buf, utf8encode(bp->u, buf));
+    for (; bp <= end; ++bp) {
+      if (len + UTF_SIZ >= sizeof(buf)) {
+        tprinter(buf, len);
+        len = 0;
+      }
+      len += utf8encode(bp->u, buf + len);
+    }
   }
-  tprinter("\n", 1);
+  buf[len++] = '\n';
+  tprinter(buf, len);
 }
 
 void tdump(void) {
@@ -966,7 +1141,7 @@ void tstrsequence(uchar c) {
   }
   strreset();
   strescseq.type = c;
-  term.esc |= ESC_STR;
+  term.esc = ESC_STR;
 }
 
 void tcontrolcode(uchar ascii) {
@@ -987,17 +1162,7 @@ void tcontrolcode(uchar ascii) {
     tnewline(IS_SET(MODE_CRLF));
     return;
   case '\a': /* BEL */
-    if (term.esc & ESC_STR_END) {
-      /* backwards compatibility to xterm */
-      strhandle();
-    } else {
-      //xbell();
-    }
-    break;
-  case '\033': /* ESC */
-    csireset();
-    term.esc &= ~(ESC_CSI | ESC_ALTCHARSET | ESC_TEST);
-    term.esc |= ESC_START;
+    terminal_callbacks.bell();
     return;
   case '\016': /* SO (LS1 -- Locking shift 1) */
   case '\017': /* SI (LS0 -- Locking shift 0) */
@@ -1008,7 +1173,7 @@ void tcontrolcode(uchar ascii) {
     /* FALLTHROUGH */
   case '\030': /* CAN */
     csireset();
-    break;
+    return;
   case '\005': /* ENQ (IGNORED) */
   case '\000': /* NUL (IGNORED) */
   case '\021': /* XON (IGNORED) */
@@ -1020,16 +1185,16 @@ void tcontrolcode(uchar ascii) {
   case 0x82: /* TODO: BPH */
   case 0x83: /* TODO: NBH */
   case 0x84: /* TODO: IND */
-    break;
+    return;
   case 0x85:     /* NEL -- Next line */
     tnewline(1); /* always go to first col */
-    break;
+    return;
   case 0x86: /* TODO: SSA */
   case 0x87: /* TODO: ESA */
-    break;
+    return;
   case 0x88: /* HTS -- Horizontal tab stop */
     term.tabs[term.cursor.x] = 1;
-    break;
+    return;
   case 0x89: /* TODO: HTJ */
   case 0x8a: /* TODO: VTS */
   case 0x8b: /* TODO: PLD */
@@ -1046,13 +1211,13 @@ void tcontrolcode(uchar ascii) {
   case 0x97: /* TODO: EPA */
   case 0x98: /* TODO: SOS */
   case 0x99: /* TODO: SGCI */
-    break;
+    return;
   case 0x9a: /* DECID -- Identify Terminal */
-    write_to_tty(vtiden, strlen(vtiden), 0);
-    break;
+    terminal_callbacks.ttywrite(vtiden, strlen(vtiden), 0);
+    return;
   case 0x9b: /* TODO: CSI */
   case 0x9c: /* TODO: ST */
-    break;
+    return;
   case 0x90: /* DCS -- Device Control String */
   case 0x9d: /* OSC -- Operating System Command */
   case 0x9e: /* PM -- Privacy Message */
@@ -1060,43 +1225,40 @@ void tcontrolcode(uchar ascii) {
     tstrsequence(ascii);
     return;
   }
-  /* only CAN, SUB, \a and C1 chars interrupt a sequence */
-  term.esc &= ~(ESC_STR_END | ESC_STR);
 }
 
 /*
- * returns 1 when the sequence is finished and it hasn't to read
- * more characters for this sequence, otherwise 0
+ * ESC dispatch, called with the final byte. The sequence starters
+ * ESC [, ESC P, ESC ] ... never get here, the parser follows them.
  */
-int eschandle(uchar ascii) {
-  switch (ascii) {
-  case '[':
-    term.esc |= ESC_CSI;
-    return 0;
+void eschandle(uchar ascii) {
+  switch (csiescseq.inter) {
+  case '\0':
+    break;
   case '#':
-    term.esc |= ESC_TEST;
-    return 0;
+    tdectest(ascii);
+    return;
   case '%':
-    term.esc |= ESC_UTF8;
-    return 0;
-  case 'P': /* DCS -- Device Control String */
-  case '_': /* APC -- Application Program Command */
-  case '^': /* PM -- Privacy Message */
-  case ']': /* OSC -- Operating System Command */
-  case 'k': /* old title set compatibility */
-    tstrsequence(ascii);
-    return 0;
-  case 'n': /* LS2 -- Locking shift 2 */
-  case 'o': /* LS3 -- Locking shift 3 */
-    term.charset = 2 + (ascii - 'n');
-    break;
+    tdefutf8(ascii);
+    return;
   case '(': /* GZD4 -- set primary charset G0 */
   case ')': /* G1D4 -- set secondary charset G1 */
   case '*': /* G2D4 -- set tertiary charset G2 */
   case '+': /* G3D4 -- set quaternary charset G3 */
-    term.icharset = ascii - '(';
-    term.esc |= ESC_ALTCHARSET;
-    return 0;
+    term.icharset = csiescseq.inter - '(';
+    tdeftran(ascii);
+    return;
+  default:
+    fprintf(stderr, "erresc: unknown sequence ESC %c 0x%02X '%c'\n",
+            csiescseq.inter, (uchar)ascii, isprint(ascii) ? ascii : '.');
+    return;
+  }
+
+  switch (ascii) {
+  case 'n': /* LS2 -- Locking shift 2 */
+  case 'o': /* LS3 -- Locking shift 3 */
+    term.charset = 2 + (ascii - 'n');
+    break;
   case 'D': /* IND -- Linefeed */
     if (term.cursor.y == term.bot) {
       tscrollup(term.top, 1);
@@ -1118,20 +1280,20 @@ int eschandle(uchar ascii) {
     }
     break;
   case 'Z': /* DECID -- Identify Terminal */
-    write_to_tty(vtiden, strlen(vtiden), 0);
+    terminal_callbacks.ttywrite(vtiden, strlen(vtiden), 0);
     break;
   case 'c': /* RIS -- Reset to initial state */
     treset();
-    //resettitle();
-    xloadcols();
-    xsetmode(0, MODE_HIDE);
+    resettitle();
+    terminal_callbacks.loadcols();
+    terminal_callbacks.setmode(0, MODE_HIDE);
     break;
   case '=': /* DECPAM -- Application keypad */
-    xsetmode(1, MODE_APPKEYPAD);
+    terminal_callbacks.setmode(1, MODE_APPKEYPAD);
     printf("APP KEY PAD mode\n");
     break;
   case '>': /* DECPNM -- Normal keypad */
-    xsetmode(0, MODE_APPKEYPAD);
+    terminal_callbacks.setmode(0, MODE_APPKEYPAD);
     printf("NO APP KEY PAD mode\n");
     break;
   case '7': /* DECSC -- Save Cursor */
@@ -1140,122 +1302,148 @@ int eschandle(uchar ascii) {
   case '8': /* DECRC -- Restore Cursor */
     tcursor(CURSOR_LOAD);
     break;
-  case '\\': /* ST -- String Terminator */
-    if (term.esc & ESC_STR_END)
-      strhandle();
+  case '\\': /* ST -- String Terminator, the string ended at the ESC */
     break;
   default:
     fprintf(stderr, "erresc: unknown sequence ESC 0x%02X '%c'\n", (uchar)ascii,
             isprint(ascii) ? ascii : '.');
     break;
   }
-  return 1;
 }
 
-void tputc(Rune u) {
-  char c[UTF_SIZ];
-  int control;
-  int width, len;
-  PGlyph *glyph_pointer;
-
-  int original_rune = u;
-
-  control = ISCONTROL(u);
-  if (u < 127 || !IS_SET(MODE_UTF8)) {
-    c[0] = u;
-    width = len = 1;
-  } else {
-    len = utf8encode(u, c);
-    if (!control && (width = wcwidth(u)) == -1)
-      width = 1;
-  }
+/*
+ * Parser after Paul Williams' DEC compatible state machine
+ * (https://vt100.net/emu/dec_ansi_parser). Runes are reduced to a class,
+ * and vtstates[state][class] holds the action to run in the high nibble
+ * and the next state in the low one.
+ */
+enum vt_class {
+  VC_C0,     /* C0 controls without a special meaning for the parser */
+  VC_BEL,    /* ends OSC strings for xterm compatibility */
+  VC_CANCEL, /* CAN and SUB abort any sequence */
+  VC_ESC,
+  VC_INTER,  /* intermediate bytes 0x20 - 0x2f */
+  VC_DIGIT,
+  VC_SEP,    /* : ; */
+  VC_MARKER, /* private markers < = > ? */
+  VC_CSI,    /* [ */
+  VC_STR,    /* P ] ^ _ k start a string after ESC */
+  VC_FINAL,  /* remaining bytes up to 0x7e */
+  VC_DEL,
+  VC_C1,
+  VC_ST,     /* 0x9c */
+  VC_PRINT,  /* 0xa0 and above */
+  VC_CLASSES,
+};
 
-  if (IS_SET(MODE_PRINT))
-    tprinter(c, len);
+enum vt_action {
+  VA_IGNORE,
+  VA_PRINT,
+  VA_EXECUTE,
+  VA_C1,
+  VA_ESC,
+  VA_COLLECT,
+  VA_PARAM,
+  VA_ESC_DISPATCH,
+  VA_CSI_DISPATCH,
+  VA_STR_START,
+  VA_STR_PUT,
+  VA_STR_END,
+};
 
-  /*
-   * STR sequence must be checked before anything else
-   * because it uses all following characters until it
-   * receives a ESC, a SUB, a ST or any other C1 control
-   * character.
-   */
-  if (term.esc & ESC_STR) {
-    if (u == '\a' || u == 030 || u == 032 || u == 033 || ISCONTROLC1(u)) {
-      term.esc &= ~(ESC_START | ESC_STR);
-      term.esc |= ESC_STR_END;
-      goto check_control_code;
-    }
+#define VTCLASS(u) ((u) < LEN(vtclass) ? vtclass[u] : VC_PRINT)
+#define VT(action, state) ((action) << 4 | (state))
+
+static const uchar vtclass[0xa0] = {
+    [0x00 ... 0x1f] = VC_C0,     ['\a'] = VC_BEL,
+    [030] = VC_CANCEL,           [032] = VC_CANCEL,
+    [033] = VC_ESC,              [0x20 ... 0x2f] = VC_INTER,
+    ['0' ... '9'] = VC_DIGIT,    [':'] = VC_SEP,
+    [';'] = VC_SEP,              ['<' ... '?'] = VC_MARKER,
+    ['@' ... '~'] = VC_FINAL,    ['['] = VC_CSI,
+    ['P'] = VC_STR,              [']'] = VC_STR,
+    ['^'] = VC_STR,              ['_'] = VC_STR,
+    ['k'] = VC_STR,              [0x7f] = VC_DEL,
+    [0x80 ... 0x9f] = VC_C1,     [0x9c] = VC_ST,
+};
 
-    if (strescseq.len + len >= strescseq.siz) {
-      /*
-       * Here is a bug in terminals. If the user never sends
-       * some code to stop the str or esc command, then st
-       * will stop responding. But this is better than
-       * silently failing with unknown characters. At least
-       * then users will report back.
-       *
-       * In the case users ever get fixed, here is the code:
-       */
-      /*
-       * term.esc = 0;
-       * strhandle();
-       */
-      if (strescseq.siz > (SIZE_MAX - UTF_SIZ) / 2)
-        return;
-      strescseq.siz *= 2;
-      strescseq.buf = xrealloc(strescseq.buf, strescseq.siz);
-    }
+/* controls are executed inside sequences without leaving them */
+#define VT_ANYWHERE(state)                                                     \
+  [VC_C0] = VT(VA_EXECUTE, state), [VC_BEL] = VT(VA_EXECUTE, state),           \
+  [VC_CANCEL] = VT(VA_EXECUTE, ESC_GROUND), [VC_ESC] = VT(VA_ESC, ESC_ESCAPE), \
+  [VC_DEL] = VT(VA_IGNORE, state), [VC_C1] = VT(VA_C1, state),                 \
+  [VC_ST] = VT(VA_C1, state)
+
+static const uchar vtstates[ESC_STATES][VC_CLASSES] = {
+    [ESC_GROUND] = {
+        VT_ANYWHERE(ESC_GROUND),
+        [VC_INTER ... VC_FINAL] = VT(VA_PRINT, ESC_GROUND),
+        [VC_PRINT] = VT(VA_PRINT, ESC_GROUND),
+    },
+    [ESC_ESCAPE] = {
+        VT_ANYWHERE(ESC_ESCAPE),
+        [VC_INTER] = VT(VA_COLLECT, ESC_ESCAPE_INTERMEDIATE),
+        [VC_DIGIT ... VC_MARKER] = VT(VA_ESC_DISPATCH, ESC_GROUND),
+        [VC_CSI] = VT(VA_IGNORE, ESC_CSI_ENTRY),
+        [VC_STR] = VT(VA_STR_START, ESC_STR),
+        [VC_FINAL] = VT(VA_ESC_DISPATCH, ESC_GROUND),
+        [VC_PRINT] = VT(VA_ESC_DISPATCH, ESC_GROUND),
+    },
+    [ESC_ESCAPE_INTERMEDIATE] = {
+        VT_ANYWHERE(ESC_ESCAPE_INTERMEDIATE),
+        [VC_INTER] = VT(VA_COLLECT, ESC_ESCAPE_INTERMEDIATE),
+        [VC_DIGIT ... VC_FINAL] = VT(VA_ESC_DISPATCH, ESC_GROUND),
+        [VC_PRINT] = VT(VA_ESC_DISPATCH, ESC_GROUND),
+    },
+    [ESC_CSI_ENTRY] = {
+        VT_ANYWHERE(ESC_CSI_ENTRY),
+        [VC_INTER] = VT(VA_COLLECT, ESC_CSI_INTERMEDIATE),
+        [VC_DIGIT ... VC_MARKER] = VT(VA_PARAM, ESC_CSI_PARAM),
+        [VC_CSI ... VC_FINAL] = VT(VA_CSI_DISPATCH, ESC_GROUND),
+        [VC_PRINT] = VT(VA_IGNORE, ESC_CSI_IGNORE),
+    },
+    [ESC_CSI_PARAM] = {
+        VT_ANYWHERE(ESC_CSI_PARAM),
+        [VC_INTER] = VT(VA_COLLECT, ESC_CSI_INTERMEDIATE),
+        [VC_DIGIT ... VC_SEP] = VT(VA_PARAM, ESC_CSI_PARAM),
+        [VC_MARKER] = VT(VA_IGNORE, ESC_CSI_IGNORE),
+        [VC_CSI ... VC_FINAL] = VT(VA_CSI_DISPATCH, ESC_GROUND),
+        [VC_PRINT] = VT(VA_IGNORE, ESC_CSI_IGNORE),
+    },
+    [ESC_CSI_INTERMEDIATE] = {
+        VT_ANYWHERE(ESC_CSI_INTERMEDIATE),
+        [VC_INTER] = VT(VA_COLLECT, ESC_CSI_INTERMEDIATE),
+        [VC_DIGIT ... VC_MARKER] = VT(VA_IGNORE, ESC_CSI_IGNORE),
+        [VC_CSI ... VC_FINAL] = VT(VA_CSI_DISPATCH, ESC_GROUND),
+        [VC_PRINT] = VT(VA_IGNORE, ESC_CSI_IGNORE),
+    },
+    [ESC_CSI_IGNORE] = {
+        VT_ANYWHERE(ESC_CSI_IGNORE),
+        [VC_INTER ... VC_MARKER] = VT(VA_IGNORE, ESC_CSI_IGNORE),
+        [VC_CSI ... VC_FINAL] = VT(VA_IGNORE, ESC_GROUND),
+        [VC_PRINT] = VT(VA_IGNORE, ESC_CSI_IGNORE),
+    },
+    [ESC_STR] = {
+        /* everything but the terminators is part of the string */
+        [VC_C0] = VT(VA_STR_PUT, ESC_STR),
+        [VC_BEL] = VT(VA_STR_END, ESC_GROUND),
+        [VC_CANCEL] = VT(VA_EXECUTE, ESC_GROUND),
+        [VC_ESC] = VT(VA_ESC, ESC_ESCAPE),
+        [VC_INTER ... VC_DEL] = VT(VA_STR_PUT, ESC_STR),
+        [VC_C1] = VT(VA_IGNORE, ESC_GROUND),
+        [VC_ST] = VT(VA_STR_END, ESC_GROUND),
+        [VC_PRINT] = VT(VA_STR_PUT, ESC_STR),
+    },
+};
 
-    memmove(&strescseq.buf[strescseq.len], c, len);
-    strescseq.len += len;
-    return;
-  }
+static void tprint(Rune u) {
+  int width;
+  PGlyph *glyph_pointer;
 
-check_control_code:
-  /*
-   * Actions of control codes must be performed as soon they arrive
-   * because they can be embedded inside a control sequence, and
-   * they must not cause conflicts with sequences.
-   */
-  if (control) {
-    /* in UTF-8 mode ignore handling C1 control characters */
-    if (IS_SET(MODE_UTF8) && ISCONTROLC1(u))
-      return;
-    tcontrolcode(u);
-    /*
-     * control codes are not shown ever
-     */
-    if (!term.esc)
-      term.lastc = 0;
-    return;
-  } else if (term.esc & ESC_START) {
-    if (term.esc & ESC_CSI) {
-      csiescseq.buf[csiescseq.len++] = u;
-      if (BETWEEN(u, 0x40, 0x7E) ||
-          csiescseq.len >= sizeof(csiescseq.buf) - 1) {
-        term.esc = 0;
-        csiparse();
-        csihandle();
-      }
-      return;
-    } else if (term.esc & ESC_UTF8) {
-      tdefutf8(u);
-    } else if (term.esc & ESC_ALTCHARSET) {
-      tdeftran(u);
-    } else if (term.esc & ESC_TEST) {
-      tdectest(u);
-    } else {
-      if (!eschandle(u))
-        return;
-      /* sequence already finished */
-    }
-    term.esc = 0;
-    /*
-     * All characters which form part of a sequence are not
-     * printed
-     */
-    return;
-  }
+  if (u < 127 || !IS_SET(MODE_UTF8))
+    width = 1;
+  else
+    width = runewidth(u);
 
   if (selected(term.cursor.x, term.cursor.y))
     selclear();
@@ -1302,7 +1490,207 @@ check_control_code:
   }
 }
 
+void tputc(Rune u) {
+  char c[UTF_SIZ];
+  int len;
+  uchar prev, next;
+
+  if (IS_SET(MODE_PRINT)) {
+    if (u < 127 || !IS_SET(MODE_UTF8)) {
+      c[0] = u;
+      len = 1;
+    } else {
+      len = utf8encode(u, c);
+    }
+    tprinter(c, len);
+  }
+
+  /*
+   * The next state is entered before the action runs, so actions
+   * like tstrsequence() from a C1 control can still override it.
+   */
+  prev = term.esc;
+  next = vtstates[prev][VTCLASS(u)];
+  term.esc = next & 0x0f;
+
+  switch (next >> 4) {
+  case VA_PRINT:
+    tprint(u);
+    break;
+  case VA_C1:
+    /* in UTF-8 mode ignore handling C1 control characters */
+    if (IS_SET(MODE_UTF8))
+      break;
+    /* FALLTHROUGH */
+  case VA_EXECUTE:
+    /*
+     * Actions of control codes must be performed as soon they arrive
+     * because they can be embedded inside a control sequence, and
+     * they must not cause conflicts with sequences.
+     */
+    tcontrolcode(u);
+    /*
+     * control codes are not shown ever
+     */
+    if (!term.esc)
+      term.lastc = 0;
+    break;
+  case VA_ESC:
+    /* ESC ends a string, the ST that usually follows is a no-op */
+    if (prev == ESC_STR) {
+      strhandle();
+      stats.escapes++;
+    }
+    csireset();
+    break;
+  case VA_COLLECT:
+    csicollect(u);
+    break;
+  case VA_PARAM:
+    csiparam(u);
+    break;
+  case VA_ESC_DISPATCH:
+    eschandle(u);
+    stats.escapes++;
+    break;
+  case VA_CSI_DISPATCH:
+    csifinal(u);
+    csihandle();
+    stats.escapes++;
+    break;
+  case VA_STR_START:
+    tstrsequence(u);
+    break;
+  case VA_STR_PUT:
+    strput(u);
+    break;
+  case VA_STR_END:
+    strhandle();
+    stats.escapes++;
+    break;
+  }
+}
+
+/*
+ * Returns the length of the run of printable ASCII at the start of r.
+ */
+static int tasciispan(const Rune *r, int len) {
+  int n = 0;
+#ifdef __SSE2__
+  const __m128i space = _mm_set1_epi32(0x1f);
+  const __m128i del = _mm_set1_epi32(0x7f);
+  __m128i v;
+  uint mask;
+
+  for (; n + 4 <= len; n += 4) {
+    v = _mm_loadu_si128((const __m128i *)(r + n));
+    mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpgt_epi32(v, space), _mm_cmplt_epi32(v, del)));
+    if (mask != 0xffff)
+      return n + __builtin_ctz(~mask) / 4;
+  }
+#endif
+  while (n < len && BETWEEN(r[n], 0x20, 0x7e))
+    n++;
+
+  return n;
+}
+
+/*
+ * printable ASCII can skip tputc() when no sequence is pending and
+ * nothing but the plain write path would touch it
+ */
+static int tasciiready(void) {
+  return !term.esc &&
+         (term.mode & (MODE_WRAP | MODE_INSERT)) == MODE_WRAP &&
+         term.trantbl[term.charset] != CS_GRAPHIC0;
+}
+
+/*
+ * Same result as calling tputc() for every rune of a printable ASCII
+ * run, but wrapping, selection and dirtiness are handled once per line
+ * segment instead of once per glyph.
+ */
+static void tputascii(const Rune *r, int len) {
+  char buf[256];
+  PGlyph *gp;
+  Line line;
+  int x, y, i, n;
+
+  for (i = 0; IS_SET(MODE_PRINT) && i < len; i += n) {
+    for (n = 0; n < sizeof(buf) && i + n < len; n++)
+      buf[n] = r[i + n];
+    tprinter(buf, n);
+  }
+
+  while (len > 0) {
+    if (term.cursor.state & CURSOR_WRAPNEXT) {
+      TLINE(term.cursor.y)[term.cursor.x].mode |= ATTR_WRAP;
+      tnewline(1);
+    }
+    x = term.cursor.x;
+    y = term.cursor.y;
+    n = MIN(len, term.col - x);
+    line = TLINE(y);
+
+    if (selection.original_beginning.x != -1) {
+      for (i = x; i < x + n; i++) {
+        if (selected(i, y)) {
+          selclear();
+          break;
+        }
+      }
+    }
+
+    /* wide glyphs cut in half by the edges of the run */
+    if ((line[x].mode & ATTR_WDUMMY) && x > 0) {
+      line[x - 1].u = ' ';
+      line[x - 1].mode &= ~ATTR_WIDE;
+    }
+    if ((line[x + n - 1].mode & ATTR_WIDE) && x + n < term.col) {
+      line[x + n].u = ' ';
+      line[x + n].mode &= ~ATTR_WDUMMY;
+    }
+
+    for (gp = &line[x], i = 0; i < n; i++, gp++) {
+      *gp = term.cursor.attr;
+      gp->u = r[i];
+    }
+    term.dirty[y] = 1;
+
+    r += n;
+    len -= n;
+    if (x + n < term.col) {
+      tmoveto(x + n, y);
+    } else {
+      term.cursor.x = term.col - 1;
+      term.cursor.state |= CURSOR_WRAPNEXT;
+    }
+  }
+  term.lastc = r[-1];
+}
+
+/*
+ * Puts a batch of decoded runes, taking the bulk path for every
+ * printable ASCII run in it.
+ */
+static void tputrunes(const Rune *r, int len) {
+  int i, n;
+
+  for (i = 0; i < len; i += n) {
+    if (tasciiready() && (n = tasciispan(r + i, len - i)) > 0) {
+      tputascii(r + i, n);
+    } else {
+      tputc(r[i]);
+      n = 1;
+    }
+  }
+}
+
 int twrite(const char *buf, int buflen, int show_ctrl) {
+  Rune runes[TWRITE_RUNES];
+  const char *esc;
+  size_t nrunes;
   int charsize;
   Rune u;
   int n;
@@ -1313,6 +1701,21 @@ int twrite(const char *buf, int buflen, int show_ctrl) {
   }
 
   for (n = 0; n < buflen; n += charsize) {
+    /*
+     * Outside of sequences decode in batches up to the next ESC. Only a
+     * sequence can change how the bytes after it are decoded.
+     */
+    if (!term.esc && !show_ctrl && IS_SET(MODE_UTF8)) {
+      esc = memchr(buf + n, '\033', buflen - n);
+      nrunes = LEN(runes);
+      charsize = utf8decodebuf(buf + n, esc ? esc - (buf + n) : buflen - n,
+                               runes, &nrunes);
+      if (nrunes > 0) {
+        tputrunes(runes, nrunes);
+        continue;
+      }
+      /* the ESC itself or a sequence cut short, see below */
+    }
     if (IS_SET(MODE_UTF8)) {
       /* process a complete utf8 char */
       charsize = utf8decode(buf + n, &u, buflen - n);
@@ -1334,6 +1737,7 @@ int twrite(const char *buf, int buflen, int show_ctrl) {
     }
     tputc(u);
   }
+  stats.bytes_parsed += n;
   return n;
 }
 
@@ -1346,53 +1750,103 @@ void clearline(Line line, PGlyph g, int x, int xend) {
   }
 }
 
+/* line at least term.linelen wide, the cells it gains cleared with g */
+static Line twiden(Line line, PGlyph g) {
+  int width = LINEWIDTH(line);
+
+  if (width < term.linelen) {
+    line = lineresize(line, term.linelen);
+    clearline(line, g, width, term.linelen);
+  }
+  return line;
+}
+
 Line ensureline(Line line) {
   if (!line) {
-    line = xmalloc(term.linelen * sizeof(PGlyph));
+    line = linealloc(term.linelen);
+  } else {
+    line = twiden(line, (PGlyph){.style = STYLE_DEFAULT});
   }
   return line;
 }
 
+/* lines the primary screen can be scrolled back */
+int tscrollback(void) {
+  return MIN(histlines,
+             term.screen[0].size - term.row + (unsigned int)history_count());
+}
+
+/*
+ * A line of the ring, see TLINE(). Resizing only widens the lines of the
+ * screen, a line of the scrollback narrower than the window is blank past
+ * its end and widened here when it is next shown.
+ */
+Line tringline(int y) {
+  Line *line = &TRING(y);
+
+  if (*line && LINEWIDTH(*line) < term.linelen)
+    *line = twiden(*line, (PGlyph){.style = STYLE_DEFAULT});
+  return *line;
+}
+
+/* a line of the primary screen's history past the ring, see TLINE() */
+Line tcoldline(int y) {
+  if (IS_SET(MODE_ALTSCREEN))
+    return TRING(y);
+  return history_line(TSCREEN.off - y - (TSCREEN.size - term.row) - 1);
+}
+
+/*
+ * Grows the ring of the primary screen to size lines, the screen at its
+ * start and the scrollback, newest last, at its end.
+ */
+static void tringgrow(int size) {
+  LineBuffer *lb = &term.screen[0];
+  Line *buffer = xmalloc(size * sizeof(Line));
+  int i;
+
+  for (i = 0; i < size; i++)
+    buffer[i] = NULL;
+  for (i = 0; i < lb->size; i++)
+    buffer[i < term.row ? i : size - lb->size + i] =
+        lb->buffer[(lb->cur + i) % lb->size];
+  free(lb->buffer);
+  lb->buffer = buffer;
+  lb->size = size;
+  lb->cur = 0;
+}
+
 void resize_terminal(int col, int row) {
   int i, j;
   int minrow = MIN(row, term.row);
   int mincol = MIN(col, term.col);
   int linelen = MAX(col, term.linelen);
+  int ring = row + MIN(histlines, (unsigned int)MAX(RINGHIST, row));
   int *bp;
 
-  if (col < 1 || row < 1 || row > HISTSIZE) {
+  if (col < 1 || row < 1) {
     fprintf(stderr, "tresize: error resizing to %dx%d\n", col, row);
     return;
   }
 
+  if (ring > term.screen[0].size)
+    tringgrow(ring);
+
   /* Shift buffer to keep the cursor where we expect it */
   if (row <= term.cursor.y) {
     term.screen[0].cur =
         (term.screen[0].cur - row + term.cursor.y + 1) % term.screen[0].size;
   }
 
-  /* Resize and clear line buffers as needed */
-  if (linelen > term.linelen) {
-    for (i = 0; i < term.screen[0].size; ++i) {
-      if (term.screen[0].buffer[i]) {
-        term.screen[0].buffer[i] =
-            xrealloc(term.screen[0].buffer[i], linelen * sizeof(PGlyph));
-        clearline(term.screen[0].buffer[i], term.cursor.attr, term.linelen,
-                  linelen);
-      }
-    }
-    for (i = 0; i < minrow; ++i) {
-      term.screen[1].buffer[i] =
-          xrealloc(term.screen[1].buffer[i], linelen * sizeof(PGlyph));
-      clearline(term.screen[1].buffer[i], term.cursor.attr, term.linelen,
-                linelen);
-    }
-  }
-  /* Allocate all visible lines for regular line buffer */
+  /* Allocate and widen the visible lines, the scrollback's see tringline() */
+  term.linelen = linelen;
   for (j = term.screen[0].cur, i = 0; i < row;
        ++i, j = (j + 1) % term.screen[0].size) {
     if (!term.screen[0].buffer[j]) {
-      term.screen[0].buffer[j] = xmalloc(linelen * sizeof(PGlyph));
+      term.screen[0].buffer[j] = linealloc(linelen);
+    } else {
+      term.screen[0].buffer[j] =
+          twiden(term.screen[0].buffer[j], term.cursor.attr);
     }
     if (i >= term.row) {
       clearline(term.screen[0].buffer[j], term.cursor.attr, 0, linelen);
@@ -1401,12 +1855,16 @@ void resize_terminal(int col, int row) {
   /* Resize alt screen */
   term.screen[1].cur = 0;
   term.screen[1].size = row;
+  for (i = 0; i < minrow; ++i) {
+    term.screen[1].buffer[i] =
+        twiden(term.screen[1].buffer[i], term.cursor.attr);
+  }
   for (i = row; i < term.row; ++i) {
-    free(term.screen[1].buffer[i]);
+    linefree(term.screen[1].buffer[i]);
   }
   term.screen[1].buffer = xrealloc(term.screen[1].buffer, row * sizeof(Line));
   for (i = term.row; i < row; ++i) {
-    term.screen[1].buffer[i] = xmalloc(linelen * sizeof(PGlyph));
+    term.screen[1].buffer[i] = linealloc(linelen);
     clearline(term.screen[1].buffer[i], term.cursor.attr, 0, linelen);
   }
 
@@ -1428,7 +1886,7 @@ void resize_terminal(int col, int row) {
   /* update terminal size */
   term.col = col;
   term.row = row;
-  term.linelen = linelen;
+  LIMIT(term.screen[0].off, 0, tscrollback());
   /* reset scrolling region */
   tsetscroll(0, row - 1);
   /* make use of the LIMIT in tmoveto */
@@ -1436,6 +1894,4 @@ void resize_terminal(int col, int row) {
   tfulldirt();
 }
 
-void resettitle(void) { 
-  //xsettitle(NULL); 
-}
+void resettitle(void) { terminal_callbacks.settitle(NULL); }
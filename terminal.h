@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <sys/types.h>
 #include <stddef.h>
+#include <time.h>
 #include <wchar.h>
 
 #include "types.h"
@@ -21,12 +22,36 @@ enum term_mode {
   MODE_ECHO = 1 << 4,
   MODE_PRINT = 1 << 5,
   MODE_UTF8 = 1 << 6,
+  MODE_SYNC = 1 << 7,
+};
+
+/* modes the frontend keeps, set through terminal_callbacks.setmode */
+enum win_mode {
+  MODE_VISIBLE = 1 << 0,
+  MODE_FOCUSED = 1 << 1,
+  MODE_APPKEYPAD = 1 << 2,
+  MODE_MOUSEBTN = 1 << 3,
+  MODE_MOUSEMOTION = 1 << 4,
+  MODE_REVERSE = 1 << 5,
+  MODE_KBDLOCK = 1 << 6,
+  MODE_HIDE = 1 << 7,
+  MODE_APPCURSOR = 1 << 8,
+  MODE_MOUSESGR = 1 << 9,
+  MODE_8BIT = 1 << 10,
+  MODE_BLINK = 1 << 11,
+  MODE_FBLINK = 1 << 12,
+  MODE_FOCUS = 1 << 13,
+  MODE_MOUSEX10 = 1 << 14,
+  MODE_MOUSEMANY = 1 << 15,
+  MODE_BRCKTPASTE = 1 << 16,
+  MODE_NUMLOCK = 1 << 17,
+  MODE_MOUSE = MODE_MOUSEBTN | MODE_MOUSEMOTION | MODE_MOUSEX10 |
+               MODE_MOUSEMANY,
 };
 
 
 /* macros */
-#define ATTRCMP(a, b)                                                          \
-  ((a).mode != (b).mode || (a).fg != (b).fg || (a).bg != (b).bg)
+#define ATTRCMP(a, b) ((a).mode != (b).mode || (a).style != (b).style)
 #define TIMEDIFF(t1, t2)                                                       \
   ((t1.tv_sec - t2.tv_sec) * 1000 + (t1.tv_nsec - t2.tv_nsec) / 1E6)
 
@@ -41,9 +66,18 @@ enum term_mode {
 #define TSCREEN term.screen[IS_SET(MODE_ALTSCREEN)]
 #define TLINEOFFSET(y)                                                         \
   (((y) + TSCREEN.cur - TSCREEN.off + TSCREEN.size) % TSCREEN.size)
-#define TLINE(y) (TSCREEN.buffer[TLINEOFFSET(y)])
+#define TRING(y) (TSCREEN.buffer[TLINEOFFSET(y)])
+/* a line of the screen, or of the scrollback further back than the ring */
+#define TLINE(y)                                                               \
+  ((y) - TSCREEN.off < term.row - TSCREEN.size ? tcoldline(y) : tringline(y))
 
-#define HISTSIZE 2000
+/* scrollback lines the primary screen's ring keeps expanded */
+#define RINGHIST 2000
+
+/* style ids a glyph can hold, and the one of the default colours */
+#define STYLE_MAX (1 << 20)
+#define STYLE_DEFAULT 0
+#define GLYPHSTYLE(g) (term.styles[(g).style])
 
 enum glyph_attribute {
   ATTR_NULL = 0,
@@ -65,12 +99,24 @@ enum glyph_attribute {
 
 typedef uint_least32_t Rune;
 
-typedef struct PGlyph{
-  Rune u;      /* character code */
-  ushort mode; /* attribute flags */
+typedef struct {
   uint32_t fg; /* foreground  */
   uint32_t bg; /* background  */
-  uint16_t utf8_value;
+} Style;
+
+/* fg and bg are palette indices or, with bit 24 set, 24-bit colours */
+#define TRUERED(x) (((x) & 0xff0000) >> 8)
+#define TRUEGREEN(x) (((x) & 0xff00))
+#define TRUEBLUE(x) (((x) & 0xff) << 8)
+
+#define TRUECOLOR(r, g, b) (1 << 24 | (r) << 16 | (g) << 8 | (b))
+#define IS_TRUECOL(x) (1 << 24 & (x))
+
+/* 8 bytes, the colours are interned in term.styles, see tstyle() */
+typedef struct PGlyph{
+  Rune u;              /* character code */
+  uint32_t mode : 12;  /* attribute flags */
+  uint32_t style : 20; /* index in term.styles */
 } PGlyph;
 
 typedef PGlyph *Line;
@@ -101,8 +147,6 @@ typedef struct {
   int linelen;          /* allocated line length */
   int *dirty;           /* dirtyness of lines */
   TCursor cursor;            /* cursor */
-  int old_cursor_x;              /* old cursor col */
-  int old_cursor_y;              /* old cursor row */
   int top;              /* top    scroll limit */
   int bot;              /* bottom scroll limit */
   int mode;             /* terminal mode flags */
@@ -112,8 +156,27 @@ typedef struct {
   int icharset;         /* selected charset for sequence */
   int *tabs;
   Rune lastc; /* last printed char outside of sequence, 0 if control */
+  struct timespec synctime; /* start of the synchronized update */
+  Style *styles;            /* colours of the glyphs, STYLE_MAX of them */
 } Term;
 
+/*
+ * Everything the core needs from the frontend. The defaults do nothing,
+ * a frontend replaces the fields it implements.
+ */
+typedef struct {
+  void (*ttywrite)(const char *, size_t, int); /* replies to the program */
+  void (*bell)(void);
+  void (*settitle)(const char *);     /* NULL restores the default */
+  void (*seticontitle)(const char *); /* NULL restores the default */
+  void (*setsel)(char *);             /* OSC 52, takes the string */
+  int (*getcolor)(int, uchar *, uchar *, uchar *);
+  int (*setcolorname)(int, const char *);
+  void (*loadcols)(void);
+  void (*setmode)(int, unsigned int); /* window modes, see win_mode */
+  int (*setcursor)(int);
+} TerminalCallbacks;
+
 void die(const char *, ...);
 
 void printscreen(const Arg *);
@@ -151,6 +214,9 @@ void kscrolldown(const Arg *);
 
 
 void tfulldirt(void);
+uint32_t tstyle(uint32_t fg, uint32_t bg);
+void tlock(void);
+void tunlock(void);
 void tsetdirt(int top, int bot);
 void tsetdirtattr(int attr);
 
@@ -181,6 +247,8 @@ void tsetchar(Rune, PGlyph *, int, int);
 void tsetscroll(int, int);
 void tswapscreen(void);
 void tsetmode(int, int, const int *, int);
+int tgetmode(int, int);
+int tinsync(unsigned int);
 void tcontrolcode(uchar);
 void tdectest(char);
 void tdefutf8(char);
@@ -191,6 +259,9 @@ void tstrsequence(uchar);
 
 void clearline(Line, PGlyph, int, int);
 Line ensureline(Line);
+int tscrollback(void);
+Line tringline(int);
+Line tcoldline(int);
 
 char *base64dec(const char *);
 char base64dec_getc(const char **);
@@ -199,8 +270,11 @@ ssize_t xwrite(int, const char *, size_t);
 
 void exit_pterminal();
 
-/* config.h globals */
 extern Term term;
+extern TerminalCallbacks terminal_callbacks;
+extern int iofd;
+
+/* config.h globals */
 extern char *utmp;
 extern char *scroll;
 extern char *stty_args;
@@ -1,9 +1,11 @@
+#define _GNU_SOURCE
 #include "tty.h"
 #include "terminal.h"
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -11,7 +13,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/poll.h>
 #include <sys/select.h>
 #include <sys/types.h>
@@ -19,12 +23,43 @@
 #include <termios.h>
 #include <unistd.h>
 #include <pty.h>
+#include <linux/io_uring.h>
+
+#include "stats.h"
+#include "uring.h"
 
 
-int iofd = 1;
 int cmdfd;
+int ttywaitfd;
 pid_t pid;
 
+/* set once the child is reaped or hung up the pty, the main loop leaves */
+volatile sig_atomic_t ttyexited;
+
+/* set once sigchld() reaped the child, with its wait status */
+static volatile sig_atomic_t reaped, childstatus;
+
+/* set once ttyhangup() sent SIGHUP, the child did not end on its own */
+static int hungup;
+
+/* completions on the io_uring */
+enum { TTY_READ = 1, TTY_WRITE };
+
+/* pty output not parsed yet, in a ring, see read_tty() */
+static char *buf;
+static size_t bufsize, bufhead;
+static int buflen = 0;
+static int readqueued;
+
+/* bytes for the child, written out by ttyflush() as the pty takes them */
+static char *outbuf;
+static size_t outhead, outlen, outsize;
+static char *outflight; /* the buffer io_uring writes from, if it does */
+
+/* wakes drain() when ttyflush() left bytes, see there */
+static int drainfd = -1;
+static int draining;
+
 void new_serial_tty(char **args) {
   char cmd[_POSIX_ARG_MAX], **argument_pointer, *queue, *string;
   size_t arguments_lenght, current_argument_size;
@@ -76,7 +111,7 @@ int ttynew(const char *line, char *cmd, const char *out, char **args) {
       die("open line '%s' failed: %s\n", line, strerror(errno));
     dup2(cmdfd, 0);
     new_serial_tty(args);
-    return cmdfd;
+    return ttyinit();
   }
   //end serial terminal
 
@@ -107,33 +142,251 @@ int ttynew(const char *line, char *cmd, const char *out, char **args) {
     signal(SIGCHLD, sigchld);
     break;
   }
-  return cmdfd;
+  return ttyinit();
 }
 
+/*
+ * Sets up I/O on cmdfd and returns ttywaitfd, what to poll for it. That is
+ * cmdfd, non-blocking, or with ttyuring the ring, which has a read queued
+ * at all times and takes the writes of ttyflush().
+ */
+int ttyinit(void) {
+  if (ttyuring && (ttywaitfd = uring_init(4)) < 0) {
+    fprintf(stderr, "io_uring unavailable, using read() and write()\n");
+    ttyuring = 0;
+  }
+  if (!ttyuring) {
+    fcntl(cmdfd, F_SETFL, fcntl(cmdfd, F_GETFL) | O_NONBLOCK);
+    return ttywaitfd = cmdfd;
+  }
+
+  /* a non-blocking fd would make io_uring hand back EAGAIN */
+  fcntl(cmdfd, F_SETFL, fcntl(cmdfd, F_GETFL) & ~O_NONBLOCK);
+  read_tty(); /* queues the first read */
+  return ttywaitfd;
+}
+
+/*
+ * Size for the read buffer once a read filled it: as much as parses in a
+ * quarter of parsebudget at the rate seen so far, a power of two between
+ * TTYBUF_MIN and TTYBUF_MAX.
+ */
+static size_t ttybufsize(size_t size, int parsed, uint64_t us) {
+  static double rate; /* bytes per microsecond */
+  double target;
+
+  rate = rate ? (rate * 7 + (double)parsed / MAX(us, 1)) / 8
+              : (double)parsed / MAX(us, 1);
+  target = rate * parsebudget * 1000 / 4;
+
+  while (size < TTYBUF_MAX && size * 2 <= target)
+    size *= 2;
+  while (size > TTYBUF_MIN && size > target)
+    size /= 2;
+  return size;
+}
+
+/*
+ * A ring of size bytes mapped twice in a row, so the bytes from any offset
+ * up to size further on are contiguous, across the wrap point too.
+ */
+static char *ringmap(size_t size) {
+  char *ring;
+  int fd;
+
+  if ((fd = memfd_create("pterminal-tty", MFD_CLOEXEC)) < 0)
+    die("memfd_create failed: %s\n", strerror(errno));
+  if (ftruncate(fd, size) < 0)
+    die("ftruncate failed: %s\n", strerror(errno));
+  ring = mmap(NULL, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring == MAP_FAILED ||
+      mmap(ring, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd,
+           0) == MAP_FAILED ||
+      mmap(ring + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+           fd, 0) == MAP_FAILED)
+    die("couldn't map the tty ring: %s\n", strerror(errno));
+  close(fd);
+  return ring;
+}
+
+/* with ttyuring, keeps a read queued into the free part of buf */
+static void queueread(void) {
+  if (!ttyuring || readqueued)
+    return;
+  tlock();
+  uring_queue(IORING_OP_READ, cmdfd, buf + bufhead + buflen, bufsize - buflen,
+              TTY_READ);
+  if (uring_submit() < 0)
+    die("io_uring submit failed: %s\n", strerror(errno));
+  readqueued = 1;
+  tunlock();
+}
+
+/* a write from outflight is done, res as write() returns it or -errno */
+static void ttywritten(int res) {
+  if (outflight != outbuf)
+    free(outflight);
+  outflight = NULL;
+  if (res == -EINTR || res == -EAGAIN)
+    return;
+  if (res < 0)
+    die("write error on tty: %s\n", strerror(-res));
+  stats.writes++;
+  stats.bytes_written += res;
+  outhead += res;
+  if (outhead == outlen)
+    outhead = outlen = 0;
+}
+
+/*
+ * The last of the child's side of the pty was closed, mostly because it
+ * exits. Whichever thread reads the pty, only the main loop exits: the
+ * parser thread returns from read_tty_until_idle() and wakes it.
+ */
+static void ttyhungup(void) {
+  ttyexited = 1;
+}
+
+/*
+ * Takes what io_uring completed and returns the result of the queued read,
+ * -EAGAIN while it is still waiting for the pty.
+ */
+static int ttyreap(void) {
+  uint64_t data;
+  int res, ret = -EAGAIN;
+
+  tlock();
+  while (uring_complete(&data, &res)) {
+    if (data == TTY_WRITE) {
+      ttywritten(res);
+    } else {
+      readqueued = 0;
+      ret = res;
+    }
+  }
+  tunlock();
+  return ret;
+}
+
+/*
+ * The pty is read straight into the free part of a mirrored ring and
+ * twrite() parses the unprocessed part in place, however it wraps. Bytes
+ * of an incomplete UTF-8 sequence just stay where they are.
+ */
 size_t read_tty(void) {
-  static char buf[BUFSIZ];
-  static int buflen = 0;
-  int ret, written;
+  struct pollfd tty = {.fd = cmdfd, .events = POLLIN};
+  int ret, n, written;
+  uint64_t start;
+  size_t size;
+  char *ring;
+
+  if (!buf) {
+    buf = ringmap(bufsize = TTYBUF_MIN);
+    stats.read_buffer = bufsize;
+  }
 
   /* append read bytes to unprocessed bytes */
-  ret = read(cmdfd, buf + buflen, LEN(buf) - buflen);
+  if (!ttyuring)
+    ret = read(cmdfd, buf + bufhead + buflen, bufsize - buflen);
+  else if ((ret = ttyreap()) < 0) {
+    errno = -ret;
+    ret = -1;
+  }
 
   switch (ret) {
   case 0:
-    exit(0);
+    ttyhungup();
+    return 0;
   case -1:
+    if (errno == EAGAIN || errno == EINTR) {
+      queueread();
+      return 0;
+    }
+    if (errno == EIO) {
+      ttyhungup();
+      return 0;
+    }
     die("couldn't read from shell: %s\n", strerror(errno));
   default:
+    /* drain what else is waiting, a pty hands out 4 KB per read */
+    while (!ttyuring && buflen + ret < bufsize && poll(&tty, 1, 0) > 0 &&
+           (n = read(cmdfd, buf + bufhead + buflen + ret,
+                     bufsize - buflen - ret)) > 0)
+      ret += n;
+    stats.reads++;
+    stats.bytes_read += ret;
     buflen += ret;
-    written = twrite(buf, buflen, 0);
+    start = stats_now();
+    tlock();
+    written = twrite(buf + bufhead, buflen, 0);
+    tunlock();
+    stats_add(&stats.parse, start);
+    size = bufsize;
+    /* a full buffer means the program writes faster than we read */
+    if (buflen == bufsize)
+      size = ttybufsize(bufsize, written, stats_now() - start);
     buflen -= written;
-    /* keep any incomplete UTF-8 byte sequence for the next call */
-    if (buflen > 0)
-      memmove(buf, buf + written, buflen);
+    bufhead = (bufhead + written) % bufsize;
+    if (size != bufsize) {
+      /* only the tail of an incomplete sequence moves over */
+      ring = ringmap(size);
+      memcpy(ring, buf + bufhead, buflen);
+      munmap(buf, 2 * bufsize);
+      buf = ring;
+      bufsize = size;
+      bufhead = 0;
+      stats.read_buffer = bufsize;
+    }
+    queueread();
     return ret;
   }
 }
 
+/*
+ * Parses pty output until it goes idle and returns 1, the screen should be
+ * drawn then. Idle means nothing arrived for minlatency, or less the closer
+ * trigger, when the undrawn output began, is to maxlatency. An open
+ * synchronized update is waited for instead, for at most synctimeout.
+ * Returns 0 when more output is waiting after parsebudget, so that pending
+ * input is handled before the rest is parsed.
+ */
+int read_tty_until_idle(struct timespec *trigger) {
+  struct pollfd tty = {.fd = ttywaitfd, .events = POLLIN};
+  struct timespec start, last, now;
+  double timeout;
+  int sync;
+
+  stats.wakeups++;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  read_tty();
+  last = start;
+
+  for (;;) {
+    /* nothing more will come, the main loop is on its way out */
+    if (ttyexited)
+      return 1;
+    /* replies to what was just parsed, in one write */
+    ttyflush();
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    tlock();
+    if ((sync = tinsync(synctimeout)))
+      timeout = synctimeout - TIMEDIFF(now, term.synctime);
+    tunlock();
+    if (!sync)
+      timeout = (maxlatency - TIMEDIFF(now, (*trigger))) / maxlatency *
+                minlatency;
+    if (timeout <= 0 || poll(&tty, 1, timeout) <= 0)
+      return 1;
+    if (!(tty.revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)))
+      continue;
+    /* stop before the next read would take us past the budget */
+    if (TIMEDIFF(now, start) + TIMEDIFF(now, last) > parsebudget)
+      return 0;
+    last = now;
+    read_tty();
+  }
+}
+
 void write_to_tty(const char *s, size_t n, int may_echo) {
   const char *next;
 
@@ -160,59 +413,128 @@ void write_to_tty(const char *s, size_t n, int may_echo) {
   }
 }
 
+/*
+ * Queues s for the child, it never blocks. The main loop writes the queue
+ * out with ttyflush(), so many small replies go out in one write(). Called
+ * with the term lock held, like everything that ends up here.
+ */
 void ttywriteraw(const char *s, size_t n) {
-  fd_set wfd, rfd;
+  char *old;
+
+  if (outlen + n > outsize) {
+    /* reuse what was written out already before growing */
+    if (!outflight) {
+      memmove(outbuf, outbuf + outhead, outlen - outhead);
+      outlen -= outhead;
+      outhead = 0;
+    }
+    if (outlen + n > outsize) {
+      outsize = MAX(MAX(outsize * 2, outlen + n), BUFSIZ);
+      if (outflight == outbuf) {
+        /* io_uring still writes from it, ttywritten() frees it */
+        old = outbuf;
+        outbuf = xmalloc(outsize);
+        memcpy(outbuf, old, outlen);
+      } else {
+        outbuf = xrealloc(outbuf, outsize);
+      }
+    }
+  }
+  memcpy(outbuf + outlen, s, n);
+  outlen += n;
+}
+
+/* writes as much of the queue as the pty takes, returns what is left */
+static size_t ttywritequeue(void) {
   ssize_t r;
-  size_t lim = 256;
-
-  /*
-   * Remember that we are using a pty, which might be a modem line.
-   * Writing too much will clog the line. That's why we are doing this
-   * dance.
-   * FIXME: Migrate the world to Plan 9.
-   */
-  while (n > 0) {
-    FD_ZERO(&wfd);
-    FD_ZERO(&rfd);
-    FD_SET(cmdfd, &wfd);
-    FD_SET(cmdfd, &rfd);
 
-    /* Check if we can write. */
-    if (pselect(cmdfd + 1, &rfd, &wfd, NULL, NULL, NULL) < 0) {
+  while (outhead < outlen) {
+    if ((r = write(cmdfd, outbuf + outhead, outlen - outhead)) < 0) {
       if (errno == EINTR)
         continue;
-      die("select failed: %s\n", strerror(errno));
-    }
-    if (FD_ISSET(cmdfd, &wfd)) {
-      /*
-       * Only write the bytes written by ttywrite() or the
-       * default of 256. This seems to be a reasonable value
-       * for a serial line. Bigger values might clog the I/O.
-       */
-      if ((r = write(cmdfd, s, (n < lim) ? n : lim)) < 0)
-        goto write_error;
-      if (r < n) {
-        /*
-         * We weren't able to write out everything.
-         * This means the buffer is getting full
-         * again. Empty it.
-         */
-        if (n < lim)
-          lim = read_tty();
-        n -= r;
-        s += r;
-      } else {
-        /* All bytes have been written. */
+      if (errno == EAGAIN)
         break;
-      }
+      die("write error on tty: %s\n", strerror(errno));
     }
-    if (FD_ISSET(cmdfd, &rfd))
-      lim = read_tty();
+    stats.writes++;
+    stats.bytes_written += r;
+    outhead += r;
   }
-  return;
+  if (outhead == outlen)
+    outhead = outlen = 0;
+  return outlen - outhead;
+}
+
+/*
+ * What ttyflush() could not write goes out from this thread as the pty
+ * takes it, so a child that reads slowly and prints nothing still gets all
+ * of a paste without other events waking the main loop.
+ */
+static void *drain(void *none) {
+  struct pollfd tty = {.fd = cmdfd, .events = POLLOUT};
+  uint64_t kicks;
+  sigset_t all;
+  size_t left;
+
+  /* signals are for the main thread */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+  for (;;) {
+    if (read(drainfd, &kicks, sizeof(kicks)) < 0)
+      continue;
+    for (left = 1; left;) {
+      if (poll(&tty, 1, -1) < 0)
+        continue;
+      tlock();
+      /* hung up, the main loop is about to exit */
+      if (!(tty.revents & POLLOUT))
+        left = 0;
+      else
+        left = ttywritequeue();
+      if (!left)
+        draining = 0;
+      tunlock();
+    }
+  }
+  return NULL;
+}
 
-write_error:
-  die("write error on tty: %s\n", strerror(errno));
+/*
+ * Writes as much of the queue as the pty takes and leaves the rest to
+ * drain(). With ttyuring the queue goes in a single write the ring
+ * completes later. It takes the term lock for the queue, callers must not
+ * hold it.
+ */
+void ttyflush(void) {
+  uint64_t one = 1;
+  pthread_t thread;
+
+  tlock();
+  if (ttyuring) {
+    if (!outflight && outhead < outlen) {
+      outflight = outbuf;
+      uring_queue(IORING_OP_WRITE, cmdfd, outbuf + outhead, outlen - outhead,
+                  TTY_WRITE);
+      if (uring_submit() < 0)
+        die("io_uring submit failed: %s\n", strerror(errno));
+    }
+    tunlock();
+    return;
+  }
+  if (ttywritequeue() && !draining) {
+    if (drainfd < 0) {
+      if ((drainfd = eventfd(0, EFD_CLOEXEC)) < 0)
+        die("eventfd failed: %s\n", strerror(errno));
+      if (pthread_create(&thread, NULL, drain, NULL) != 0)
+        die("couldn't start the tty drain thread\n");
+      pthread_detach(thread);
+    }
+    draining = 1;
+    if (write(drainfd, &one, sizeof(one)) < 0)
+      die("couldn't wake the tty drain thread: %s\n", strerror(errno));
+  }
+  tunlock();
 }
 
 void resize_tty(int tw, int th) {
@@ -227,7 +549,101 @@ void resize_tty(int tw, int th) {
 }
 
 void ttyhangup(void) {
-  /* Send SIGHUP to shell */
-  kill(pid, SIGHUP);
+  /* Send SIGHUP to shell, unless it is gone and the pid may be reused */
+  if (!ttyexited) {
+    kill(pid, SIGHUP);
+    hungup = 1;
+  }
+}
+
+/*
+ * Exits the way the child did, once it is gone or hung up the pty. Through
+ * exit(), so the atexit() handlers flush the printer and dump the stats;
+ * only the main thread calls it, never a signal handler.
+ */
+void ttyexit(void) {
+  struct timespec ms = {0, 1000000};
+  int i, stat;
+
+  /* the pty hangs up just before the child exits, sigchld() reaps it */
+  for (i = 0; i < 100 && ttyexited && !reaped; i++)
+    nanosleep(&ms, NULL);
+  stat = childstatus;
+
+  if (reaped && !hungup && WIFEXITED(stat) && WEXITSTATUS(stat))
+    die("child exited with status %d\n", WEXITSTATUS(stat));
+  else if (reaped && !hungup && WIFSIGNALED(stat))
+    die("child terminated due to signal %d\n", WTERMSIG(stat));
+  exit(0);
+}
+
+void execute_shell(char *cmd, char **args) {
+  char *sh, *prog, *arg;
+  const struct passwd *pw;
+
+  errno = 0;
+  if ((pw = getpwuid(getuid())) == NULL) {
+    if (errno)
+      die("getpwuid: %s\n", strerror(errno));
+    else
+      die("who are you?\n");
+  }
+
+  if ((sh = getenv("SHELL")) == NULL)
+    sh = (pw->pw_shell[0]) ? pw->pw_shell : cmd;
+
+  if (args) {
+    prog = args[0];
+    arg = NULL;
+  } else if (scroll) {
+    prog = scroll;
+    arg = utmp ? utmp : sh;
+  } else if (utmp) {
+    prog = utmp;
+    arg = NULL;
+  } else {
+    prog = sh;
+    arg = NULL;
+  }
+  DEFAULT(args, ((char *[]){prog, arg, NULL}));
+
+  unsetenv("COLUMNS");
+  unsetenv("LINES");
+  unsetenv("TERMCAP");
+  setenv("LOGNAME", pw->pw_name, 1);
+  setenv("USER", pw->pw_name, 1);
+  setenv("SHELL", sh, 1);
+  setenv("HOME", pw->pw_dir, 1);
+  setenv("TERM", termname, 1);
+
+  signal(SIGCHLD, SIG_DFL);
+  signal(SIGHUP, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGQUIT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGALRM, SIG_DFL);
+
+  execvp(prog, args);
+  printf("Exit from shell\n");
+  _exit(1);
 }
 
+/*
+ * Only notes that the child is gone, the main loop sees ttyexited and
+ * leaves, and ttyexit() reports it. Any thread may hold a lock here.
+ */
+void sigchld(int a) {
+  int stat, saved = errno;
+
+  if (waitpid(pid, &stat, WNOHANG) == pid) {
+    childstatus = stat;
+    reaped = 1;
+    ttyexited = 1;
+  }
+  errno = saved;
+}
+
+void sendbreak(const Arg *arg) {
+  if (tcsendbreak(cmdfd, 0))
+    perror("Error sending break");
+}
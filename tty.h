@@ -1,20 +1,38 @@
 #ifndef TTY_H
 #define TTY_H
 
+#include <signal.h>
 #include <stdlib.h>
+#include <time.h>
+
+/* bounds of the pty read buffer, see read_tty() */
+#define TTYBUF_MIN (64 * 1024)
+#define TTYBUF_MAX (1024 * 1024)
 
 void new_serial_tty(char **);
 void ttywriteraw(const char *, size_t);
+void ttyflush(void);
 
 void write_to_tty(const char *s, size_t n, int may_echo);
 
 int ttynew(const char *line, char *cmd, const char *out, char **args);
+int ttyinit(void);
+void ttyexit(void);
 
 size_t read_tty(void);
+int read_tty_until_idle(struct timespec *);
 
 
-extern int iofd;
 extern int cmdfd;
+extern int ttywaitfd;
 extern pid_t pid;
+extern volatile sig_atomic_t ttyexited;
+
+/* config.h globals */
+extern double minlatency;
+extern double maxlatency;
+extern double parsebudget;
+extern unsigned int synctimeout;
+extern int ttyuring;
 
 #endif
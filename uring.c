@@ -0,0 +1,114 @@
+/*
+ * Just enough of io_uring for tty.c, on the raw system calls so there is
+ * nothing to link. A single thread at a time may use it.
+ */
+#include "uring.h"
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "macros.h"
+
+static int ringfd = -1;
+static unsigned int *sqtail, *sqmask, *sqarray;
+static unsigned int *cqhead, *cqtail, *cqmask;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+static unsigned int queued;
+
+/* returns the ring fd, it polls readable with completions waiting */
+int uring_init(unsigned int entries) {
+  struct io_uring_params p;
+  size_t sqsize, cqsize;
+  char *sq, *cq;
+
+  memset(&p, 0, sizeof(p));
+  if ((ringfd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+    return -1;
+
+  sqsize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  cqsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    sqsize = cqsize = MAX(sqsize, cqsize);
+
+  sq = mmap(NULL, sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ringfd, IORING_OFF_SQ_RING);
+  cq = (p.features & IORING_FEAT_SINGLE_MMAP)
+           ? sq
+           : mmap(NULL, cqsize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+  sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+              PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd,
+              IORING_OFF_SQES);
+  if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+    close(ringfd);
+    return ringfd = -1;
+  }
+
+  sqtail = (unsigned int *)(sq + p.sq_off.tail);
+  sqmask = (unsigned int *)(sq + p.sq_off.ring_mask);
+  sqarray = (unsigned int *)(sq + p.sq_off.array);
+  cqhead = (unsigned int *)(cq + p.cq_off.head);
+  cqtail = (unsigned int *)(cq + p.cq_off.tail);
+  cqmask = (unsigned int *)(cq + p.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  return ringfd;
+}
+
+/*
+ * Queues a read or write of len bytes at buf on fd, sent with the next
+ * uring_submit(). data comes back with its completion. The caller keeps
+ * no more in flight than the ring has entries.
+ */
+void uring_queue(int op, int fd, void *buf, size_t len, uint64_t data) {
+  unsigned int tail = *sqtail, i = tail & *sqmask;
+  struct io_uring_sqe *sqe = &sqes[i];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = op;
+  /* a tty blocks even when asked not to, keep it out of uring_submit() */
+  sqe->flags = IOSQE_ASYNC;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->off = -1; /* the file position, meaningless for a tty */
+  sqe->user_data = data;
+  sqarray[i] = i;
+  __atomic_store_n(sqtail, tail + 1, __ATOMIC_RELEASE);
+  queued++;
+}
+
+/* hands queued requests to the kernel, -1 with errno on failure */
+int uring_submit(void) {
+  int r;
+
+  while (queued) {
+    r = syscall(__NR_io_uring_enter, ringfd, queued, 0, 0, NULL, 0);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    queued -= r;
+  }
+  return 0;
+}
+
+/* takes the oldest completion, 0 when there is none */
+int uring_complete(uint64_t *data, int *res) {
+  unsigned int head = *cqhead;
+  struct io_uring_cqe *cqe;
+
+  if (head == __atomic_load_n(cqtail, __ATOMIC_ACQUIRE))
+    return 0;
+  cqe = &cqes[head & *cqmask];
+  *data = cqe->user_data;
+  *res = cqe->res;
+  __atomic_store_n(cqhead, head + 1, __ATOMIC_RELEASE);
+  return 1;
+}
@@ -0,0 +1,12 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+int uring_init(unsigned int entries);
+void uring_queue(int op, int fd, void *buf, size_t len, uint64_t data);
+int uring_submit(void);
+int uring_complete(uint64_t *data, int *res);
+
+#endif
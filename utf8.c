@@ -1,5 +1,11 @@
 #include "utf8.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 // Array containing the 32 Unicode code points for the CP437 indices 0-31
 static const uint16_t cp437_control_map[32] = {
     // Indices 0-15
@@ -120,6 +126,81 @@ size_t utf8decode(const char *c, Rune *u, size_t clen) {
   return len;
 }
 
+/*
+ * Decodes as many runes from c as fit in u. On entry *ulen is the room
+ * in u, on return the number of runes stored. Returns the number of
+ * bytes consumed; whatever is left of c is an incomplete sequence at its
+ * end or did not fit. Invalid input decodes to UTF_INVALID exactly as
+ * with utf8decode().
+ */
+size_t utf8decodebuf(const char *c, size_t clen, Rune *u, size_t *ulen) {
+  size_t i = 0, n = 0, len, room = *ulen;
+  uchar b;
+  Rune r;
+
+  while (i < clen && n < room) {
+#if defined(__AVX2__)
+    /* widen whole blocks of ASCII at a time */
+    if (clen - i >= 32 && room - n >= 32 &&
+        !_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(c + i)))) {
+      for (len = 0; len < 32; len += 8)
+        _mm256_storeu_si256(
+            (__m256i *)(u + n + len),
+            _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(c + i + len))));
+      i += 32;
+      n += 32;
+      continue;
+    }
+#elif defined(__SSE2__)
+    if (clen - i >= 16 && room - n >= 16) {
+      const __m128i zero = _mm_setzero_si128();
+      __m128i v = _mm_loadu_si128((const __m128i *)(c + i));
+
+      if (!_mm_movemask_epi8(v)) {
+        __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+
+        _mm_storeu_si128((__m128i *)(u + n), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(u + n + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i *)(u + n + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i *)(u + n + 12), _mm_unpackhi_epi16(hi, zero));
+        i += 16;
+        n += 16;
+        continue;
+      }
+    }
+#endif
+    b = c[i];
+    if (b < 0x80) {
+      u[n++] = b;
+      i++;
+      continue;
+    }
+
+    /* two and three byte sequences cover nearly all non-ASCII text */
+    if ((b & 0xE0) == 0xC0 && clen - i >= 2 && (c[i + 1] & 0xC0) == 0x80) {
+      r = (b & 0x1F) << 6 | (c[i + 1] & 0x3F);
+      u[n++] = r < 0x80 ? UTF_INVALID : r;
+      i += 2;
+      continue;
+    }
+    if ((b & 0xF0) == 0xE0 && clen - i >= 3 && (c[i + 1] & 0xC0) == 0x80 &&
+        (c[i + 2] & 0xC0) == 0x80) {
+      r = (b & 0x0F) << 12 | (c[i + 1] & 0x3F) << 6 | (c[i + 2] & 0x3F);
+      u[n++] = (r < 0x800 || BETWEEN(r, 0xD800, 0xDFFF)) ? UTF_INVALID : r;
+      i += 3;
+      continue;
+    }
+
+    if ((len = utf8decode(c + i, &u[n], clen - i)) == 0)
+      break;
+    i += len;
+    n++;
+  }
+  *ulen = n;
+
+  return i;
+}
+
 Rune utf8decodebyte(char c, size_t *i) {
   for (*i = 0; *i < LEN(utfmask); ++(*i))
     if (((uchar)c & utfmask[*i]) == utfbyte[*i])
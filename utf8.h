@@ -8,6 +8,7 @@
 #define UTF_SIZ 4
 
 size_t utf8decode(const char *, Rune *, size_t);
+size_t utf8decodebuf(const char *, size_t, Rune *, size_t *);
 Rune utf8decodebyte(char, size_t *);
 char utf8encodebyte(Rune, size_t);
 size_t utf8validate(Rune *, size_t);
@@ -6,6 +6,7 @@
 #include "terminal.h"
 #include "types.h"
 #include "draw.h"
+#include "snapshot.h"
 #include <stdio.h>
 
 #include <stdbool.h>
@@ -46,6 +47,68 @@ void end_window(){
   terminal_window.is_running = false;  
 }
 
+/*
+ * The pway callbacks below change term, so they hold the term lock against
+ * the parser thread and publish what they changed for the next frame.
+ */
+static void locked_resize(int width, int height) {
+  tlock();
+  resize_pterminal(width, height);
+  snapshot_publish(terminal_window.mode, terminal_window.cursor);
+  tunlock();
+}
+
+static void locked_focus(bool is_focused) {
+  tlock();
+  focus_window(is_focused);
+  snapshot_publish(terminal_window.mode, terminal_window.cursor);
+  tunlock();
+}
+
+static void locked_input(const char *text, int len) {
+  tlock();
+  input_keys(text, len);
+  snapshot_publish(terminal_window.mode, terminal_window.cursor);
+  tunlock();
+}
+
+static void locked_click(void) {
+  tlock();
+  mouse_click();
+  snapshot_publish(terminal_window.mode, terminal_window.cursor);
+  tunlock();
+}
+
+static void locked_release(void) {
+  tlock();
+  release_button();
+  snapshot_publish(terminal_window.mode, terminal_window.cursor);
+  tunlock();
+}
+
+static void locked_mouse(void) {
+  tlock();
+  update_mouse();
+  snapshot_publish(terminal_window.mode, terminal_window.cursor);
+  tunlock();
+}
+
+static char *locked_selection(void) {
+  char *text;
+
+  tlock();
+  text = get_selection();
+  tunlock();
+  return text;
+}
+
+static void locked_keys(void) {
+  tlock();
+  handle_keys();
+  snapshot_publish(terminal_window.mode, terminal_window.cursor);
+  tunlock();
+}
+
 void create_window(int cols, int rows){
   terminal_window.character_height = 24;
   terminal_window.character_gl_width = 32;
@@ -58,15 +121,15 @@ void create_window(int cols, int rows){
   xloadcols();
 
   pway = pway_init();
-  pway->resize = resize_pterminal;
+  pway->resize = locked_resize;
   pway->exit = end_window;
-  pway->focus = focus_window;
-  pway->input = input_keys;
-  pway->click = mouse_click;
-  pway->click_release = release_button;
-  pway->update_mouse = update_mouse;
-  pway->get_text = get_selection;
-  pway->update_keys = handle_keys;
+  pway->focus = locked_focus;
+  pway->input = locked_input;
+  pway->click = locked_click;
+  pway->click_release = locked_release;
+  pway->update_mouse = locked_mouse;
+  pway->get_text = locked_selection;
+  pway->update_keys = locked_keys;
 
 
   if(pway_create_window("pterminal0.2",terminal_window.width, terminal_window.height) == false){
@@ -126,9 +189,10 @@ void resize_pterminal(int width, int height) {
 }
 
 
+/* the next frame draws everything, main thread only */
 void redraw(void) {
   tfulldirt();
-  draw();
+  can_draw = true;
 }
 
 void zoom(const Arg *arg) {
@@ -4,63 +4,13 @@
 
 #include <time.h>
 
+#include "terminal.h"
 #include "types.h"
 #include <stdbool.h>
-#include <xkbcommon/xkbcommon.h>
-
-#include <pway/keyboard.h>
 
 /* macros */
 #define IS_WINDOSET(flag) ((terminal_window.mode & (flag)) != 0)
 
-enum win_mode {
-	MODE_VISIBLE     = 1 << 0,
-	MODE_FOCUSED     = 1 << 1,
-	MODE_APPKEYPAD   = 1 << 2,
-	MODE_MOUSEBTN    = 1 << 3,
-	MODE_MOUSEMOTION = 1 << 4,
-	MODE_REVERSE     = 1 << 5,
-	MODE_KBDLOCK     = 1 << 6,
-	MODE_HIDE        = 1 << 7,
-	MODE_APPCURSOR   = 1 << 8,
-	MODE_MOUSESGR    = 1 << 9,
-	MODE_8BIT        = 1 << 10,
-	MODE_BLINK       = 1 << 11,
-	MODE_FBLINK      = 1 << 12,
-	MODE_FOCUS       = 1 << 13,
-	MODE_MOUSEX10    = 1 << 14,
-	MODE_MOUSEMANY   = 1 << 15,
-	MODE_BRCKTPASTE  = 1 << 16,
-	MODE_NUMLOCK     = 1 << 17,
-	MODE_MOUSE       = MODE_MOUSEBTN|MODE_MOUSEMOTION|MODE_MOUSEX10\
-	                  |MODE_MOUSEMANY,
-};
-
-/* types used in config.h */
-typedef struct {
-  uint mod;
-  xkb_keysym_t keysym;
-  void (*func)(const Arg *);
-  const Arg arg;
-} Shortcut;
-
-typedef struct {
-  uint mod;
-  uint button;
-  void (*func)(const Arg *);
-  const Arg arg;
-  uint release;
-} MouseShortcut;
-
-typedef struct {
-  xkb_keysym_t key_sym;
-  uint mask;
-  char *esc_to_print;
-  /* three-valued logic variables: 0 indifferent, 1 on, -1 off */
-  signed char appkey;    /* application keypad */
-  signed char appcursor; /* application cursor */
-} Key;
-
 typedef enum window_type {WAYLAND, XORG} WindowType;
 
 /* Purely graphic info */
@@ -93,6 +43,8 @@ extern TerminalWindow terminal_window;
 
 void xsetmode(int, unsigned int);
 
+int set_terminal_cursor(int cursor);
+
 void resize_pterminal(int width, int height);
 
 